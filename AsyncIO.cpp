@@ -0,0 +1,109 @@
+#include "AsyncIO.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+EventLoop::EventLoop() {}
+
+EventLoop::~EventLoop() {
+	// Offloaded work posts back to the loop when it finishes, so it has to be done before the loop goes away
+	ThreadPool::instance().wait(offloaded);
+	if (!multi) return;
+	for (Fetch *it : transfers) curl_multi_remove_handle(multi, it->handle);
+	curl_multi_cleanup(multi);
+}
+
+bool EventLoop::Fetch::await_suspend(coroutine_handle<> caller) {
+	if (!owner.multi && !owner.start_multi()) {
+		res = CURLE_FAILED_INIT;
+		return false;
+	}
+	if (curl_multi_add_handle(owner.multi, handle) != CURLM_OK) {
+		res = CURLE_FAILED_INIT;
+		return false;
+	}
+	waiter = caller;
+	owner.transfers.push_back(this);
+	return true;
+}
+
+void EventLoop::cancel(CURL *easy) {
+	vector<Fetch *>::iterator found = find_if(transfers.begin(), transfers.end(), [&](Fetch *it) { return it->handle == easy; });
+	if (found == transfers.end()) return;
+	Fetch *fetch = *found;
+	transfers.erase(found);
+	curl_multi_remove_handle(multi, easy);
+	fetch->res = CURLE_ABORTED_BY_CALLBACK;
+	// Not resumed here, since the caller may be in the middle of something the waiter would then run on top of
+	post(fetch->waiter);
+}
+
+void EventLoop::Offload::await_suspend(coroutine_handle<> caller) {
+	// Nothing here may touch the awaiter after post, since the coroutine (and the awaiter with it) may be gone by then
+	workers.submit(owner.offloaded, [this, caller] {
+		try {
+			func();
+		} catch (...) {
+			error = current_exception();
+		}
+		func = nullptr;
+		owner.post(caller);
+	});
+}
+
+void EventLoop::post(coroutine_handle<> handle) {
+	lock_guard<mutex> lock(post_lock);
+	posted.push_back(handle);
+	// Interrupt curl_multi_poll so the loop picks it up now rather than at its next timeout
+	if (multi) curl_multi_wakeup(multi);
+	else post_ready.notify_one();
+}
+
+bool EventLoop::start_multi() {
+	lock_guard<mutex> lock(post_lock);
+	if (!multi) multi = curl_multi_init();
+	return multi != nullptr;
+}
+
+void EventLoop::step() {
+	bool progressed = false;
+	vector<coroutine_handle<>> ready;
+	{
+		lock_guard<mutex> lock(post_lock);
+		ready.swap(posted);
+	}
+	for (coroutine_handle<> it : ready) {
+		it.resume();
+		progressed = true;
+	}
+
+	if (multi && !transfers.empty()) {
+		int running = 0;
+		curl_multi_perform(multi, &running);
+		int queued = 0;
+		while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+			if (msg->msg != CURLMSG_DONE) continue;
+			vector<Fetch *>::iterator found = find_if(transfers.begin(), transfers.end(), [&](Fetch *it) { return it->handle == msg->easy_handle; });
+			if (found == transfers.end()) continue;
+			Fetch *fetch = *found;
+			transfers.erase(found);
+			fetch->res = msg->data.result;
+			curl_multi_remove_handle(multi, fetch->handle);
+			fetch->waiter.resume();
+			progressed = true;
+		}
+	}
+	if (progressed) return;
+
+	// Nothing to do until a socket is ready or offloaded work posts back
+	if (multi) {
+		curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+	} else {
+		// No multi handle to wait on, so all that can be pending is offloaded work.  Sleep until some of it posts back,
+		// rather than wait on the pool, which would have this thread pick up whatever long task is queued next
+		unique_lock<mutex> lock(post_lock);
+		post_ready.wait_for(lock, chrono::seconds(1), [&] { return !posted.empty(); });
+	}
+}
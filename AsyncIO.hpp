@@ -0,0 +1,141 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "ThreadPool.hpp"
+
+// Lazily started coroutine that produces a T.  co_await it from another coroutine, or drive it from ordinary code with
+// EventLoop::run.  Every resume happens on the thread running the loop, so a coroutine never needs a lock for its own
+// state.
+template <typename T>
+class Async {
+public: // API methods and constructors should be public
+	struct promise_type {
+		std::optional<T> value;
+		std::exception_ptr error;
+		std::coroutine_handle<> continuation; // Whoever is awaiting this one; resumed when it finishes
+		Async get_return_object() { return Async(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept {
+			struct Final {
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+					std::coroutine_handle<> next = handle.promise().continuation;
+					return next ? next : std::noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+			return Final {};
+		}
+		void return_value(T result) { value = std::move(result); }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+	Async(Async &&other) noexcept : coro(std::exchange(other.coro, nullptr)), started(other.started) {}
+	Async &operator=(Async &&other) noexcept {
+		if (this != &other) {
+			if (coro) coro.destroy();
+			coro = std::exchange(other.coro, nullptr);
+			started = other.started;
+		}
+		return *this;
+	}
+	Async(const Async &) = delete;
+	Async &operator=(const Async &) = delete;
+	~Async() { if (coro) coro.destroy(); }
+	// Run the coroutine up to its first suspension, so whatever it waits on gets going in the background
+	void start() {
+		if (started) return;
+		started = true;
+		coro.resume();
+	}
+	bool done() const { return coro.done(); }
+	// The coroutine's result.  Only valid once done() is true; rethrows anything the coroutine threw
+	T result() {
+		if (coro.promise().error) std::rethrow_exception(coro.promise().error);
+		return std::move(*coro.promise().value);
+	}
+	bool await_ready() const { return started && coro.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+		coro.promise().continuation = caller;
+		if (started) return std::noop_coroutine();
+		started = true;
+		return coro;
+	}
+	T await_resume() { return result(); }
+private: // Nothing else needs to see these
+	explicit Async(std::coroutine_handle<promise_type> handle) : coro(handle) {}
+	std::coroutine_handle<promise_type> coro;
+	bool started = false;
+};
+
+// Single-threaded executor for Async coroutines.  Network transfers go through one curl multi handle, so any number of
+// them run at once without a thread each.  The multi handle is only created by the first transfer, so a loop that's only
+// used for file writes never touches curl.  Blocking work (file writes and the like) is offloaded to the worker pool and
+// the coroutine is resumed back on the loop when it's done.  The loop only runs inside run(), on the calling thread.
+class EventLoop {
+public: // API methods and constructors should be public
+	// Awaitable for one transfer on an easy handle that's already set up.  Resumes with the transfer's result
+	class Fetch {
+	public: // API methods and constructors should be public
+		Fetch(EventLoop &loop, CURL *easy) : owner(loop), handle(easy) {}
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> caller);
+		CURLcode await_resume() const noexcept { return res; }
+	private: // Nothing else needs to see these
+		friend class EventLoop;
+		EventLoop &owner;
+		CURL *handle;
+		std::coroutine_handle<> waiter;
+		CURLcode res = CURLE_OK;
+	};
+	// Awaitable for a function run on the worker pool.  Rethrows anything the function threw
+	class Offload {
+	public: // API methods and constructors should be public
+		Offload(EventLoop &loop, ThreadPool &pool, std::function<void()> work) : owner(loop), workers(pool), func(std::move(work)) {}
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> caller);
+		void await_resume() const { if (error) std::rethrow_exception(error); }
+	private: // Nothing else needs to see these
+		EventLoop &owner;
+		ThreadPool &workers;
+		std::function<void()> func;
+		std::exception_ptr error;
+	};
+	EventLoop();
+	~EventLoop();
+	EventLoop(const EventLoop &) = delete;
+	EventLoop &operator=(const EventLoop &) = delete;
+	Fetch fetch(CURL *easy) { return Fetch(*this, easy); }
+	// Abandon the transfer in flight on easy, if there is one.  Whoever awaits it resumes with CURLE_ABORTED_BY_CALLBACK on
+	// the next step.  Only call this on the loop thread (from a coroutine, or between runs)
+	void cancel(CURL *easy);
+	Offload offload(std::function<void()> work, ThreadPool &pool = ThreadPool::instance()) { return Offload(*this, pool, std::move(work)); }
+	// Start task if it hasn't been, run the loop until it's done, and return its result
+	template <typename T>
+	T run(Async<T> &task) {
+		task.start();
+		while (!task.done()) step();
+		return task.result();
+	}
+	template <typename T>
+	T run(Async<T> &&task) { return run(task); }
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	CURLM *multi = nullptr; // Set (under post_lock, since post reads it from other threads) by the first transfer
+	std::vector<Fetch *> transfers; // In flight on the multi handle; only touched on the loop thread
+	std::mutex post_lock;
+	std::condition_variable post_ready; // Signaled by post, for a loop with no multi handle to sleep on
+	std::vector<std::coroutine_handle<>> posted; // Coroutines whose offloaded work is done, waiting to be resumed
+	ThreadPool::Group offloaded; // Offloaded work still running; the destructor waits for it
+	void step();
+	void post(std::coroutine_handle<> handle);
+	bool start_multi();
+};
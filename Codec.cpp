@@ -0,0 +1,120 @@
+#include "Codec.hpp"
+
+#include <cstdint>
+#include <zlib.h>
+
+using namespace std;
+
+namespace {
+	class ZlibCodec : public Codec {
+	public:
+		const char *name() const override { return "zlib"; }
+
+		bool deflate(const char *data, size_t len, string &outp, int level) const override {
+			// avail_in and avail_out are 32 bits, and zip entries without zip64 can't be bigger than that anyway
+			if (len > UINT32_MAX) return false;
+			z_stream strm {};
+			// Negative window bits for raw deflate; 8 is zlib's default memory level
+			if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+			outp.resize(deflateBound(&strm, static_cast<uLong>(len)));
+			strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+			strm.avail_in = static_cast<uInt>(len);
+			strm.next_out = reinterpret_cast<Bytef *>(outp.data());
+			strm.avail_out = static_cast<uInt>(outp.size());
+			// The output was sized to the bound, so one call finishes it
+			const int res = ::deflate(&strm, Z_FINISH);
+			outp.resize(strm.total_out);
+			deflateEnd(&strm);
+			return res == Z_STREAM_END;
+		}
+
+		bool deflate_part(const char *data, size_t len, string &outp, int level) const override {
+			if (len > UINT32_MAX) return false;
+			z_stream strm {};
+			if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+			// The bound is for a finished stream; the sync flush's empty stored block can be a few bytes more than the final
+			// block it replaces
+			outp.resize(deflateBound(&strm, static_cast<uLong>(len)) + 16);
+			strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+			strm.avail_in = static_cast<uInt>(len);
+			strm.next_out = reinterpret_cast<Bytef *>(outp.data());
+			strm.avail_out = static_cast<uInt>(outp.size());
+			const int res = ::deflate(&strm, Z_SYNC_FLUSH);
+			const bool done = res == Z_OK && strm.avail_in == 0 && strm.avail_out != 0;
+			outp.resize(strm.total_out);
+			deflateEnd(&strm);
+			return done;
+		}
+
+		bool can_deflate_parts() const override { return true; }
+
+		bool inflate(const char *data, size_t len, string &outp) const override {
+			if (len > UINT32_MAX || outp.size() > UINT32_MAX) return false;
+			z_stream strm {};
+			if (inflateInit2(&strm, -15) != Z_OK) return false;
+			strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+			strm.avail_in = static_cast<uInt>(len);
+			strm.next_out = reinterpret_cast<Bytef *>(outp.data());
+			strm.avail_out = static_cast<uInt>(outp.size());
+			const int res = ::inflate(&strm, Z_FINISH);
+			const bool exact = strm.total_out == outp.size();
+			inflateEnd(&strm);
+			return res == Z_STREAM_END && exact;
+		}
+	};
+
+	const ZlibCodec zlib_codec;
+
+	const Codec &default_codec() {
+		static const Codec *const chosen = [] {
+#ifdef ICD10_DEFAULT_CODEC
+			for (const Codec *it : Codec::available()) {
+				if (it->name() == string(ICD10_DEFAULT_CODEC)) return it;
+			}
+#endif
+			return static_cast<const Codec *>(&zlib_codec);
+		}();
+		return *chosen;
+	}
+}
+
+atomic<const Codec *> Codec::selected {nullptr};
+
+const vector<const Codec *> &Codec::available() {
+	static const vector<const Codec *> codecs = [] {
+		vector<const Codec *> out {&zlib_codec};
+#ifdef ICD10_WITH_ZLIB_NG
+		out.push_back(&zlib_ng_codec());
+#endif
+#ifdef ICD10_WITH_LIBDEFLATE
+		out.push_back(&libdeflate_codec());
+#endif
+#ifdef ICD10_DEFAULT_CODEC
+		// Default first
+		for (size_t i = 1; i < out.size(); i++) {
+			if (out[i]->name() == string(ICD10_DEFAULT_CODEC)) swap(out[0], out[i]);
+		}
+#endif
+		return out;
+	}();
+	return codecs;
+}
+
+const Codec *Codec::find(const string &name) {
+	for (const Codec *it : available()) {
+		if (it->name() == name) return it;
+	}
+	return nullptr;
+}
+
+const Codec &Codec::current() {
+	const Codec *codec = selected.load(memory_order_acquire);
+	return codec ? *codec : default_codec();
+}
+
+bool Codec::select(const string &name) {
+	const Codec *codec = find(name);
+	if (!codec) return false;
+	selected.store(codec, memory_order_release);
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A raw deflate (RFC 1951, no zlib or gzip wrapper, as stored in zip entries) backend.  Stock zlib is always built in;
+// zlib-ng and libdeflate are built in when ICD10_WITH_ZLIB_NG and ICD10_WITH_LIBDEFLATE are defined.  The default is
+// ICD10_DEFAULT_CODEC if it's defined and built in, zlib otherwise, and can be changed at run time with select.  Codecs
+// keep no state between calls, so one can be used from every pool worker at once
+class Codec {
+public: // API methods and constructors should be public
+	virtual ~Codec() = default;
+	virtual const char *name() const = 0;
+	// Compress len bytes of data into outp, replacing what's there.  level is 1 (fastest) to 9 (smallest)
+	virtual bool deflate(const char *data, size_t len, std::string &outp, int level) const = 0;
+	// Like deflate, but the output is a fragment: it ends with a sync flush instead of a final block, and refers to nothing
+	// before it, so fragments can be spliced end to end and finished with a deflate call.  Returns false if the codec
+	// can't produce fragments; check with can_deflate_parts first
+	virtual bool deflate_part(const char *, size_t, std::string &, int) const { return false; }
+	virtual bool can_deflate_parts() const { return false; }
+	// Inflate len bytes of data into outp, which the caller has already sized to exactly the inflated size
+	virtual bool inflate(const char *data, size_t len, std::string &outp) const = 0;
+	static const std::vector<const Codec *> &available(); // Every codec built in, the default first
+	static const Codec *find(const std::string &name); // nullptr if there's no such codec built in
+	static const Codec &current();
+	static bool select(const std::string &name); // False (and the current codec is kept) if there's no such codec
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	static std::atomic<const Codec *> selected;
+};
+
+#ifdef ICD10_WITH_ZLIB_NG
+const Codec &zlib_ng_codec(); // In CodecZlibNg.cpp
+#endif
+#ifdef ICD10_WITH_LIBDEFLATE
+const Codec &libdeflate_codec(); // In CodecLibdeflate.cpp
+#endif
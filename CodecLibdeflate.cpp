@@ -0,0 +1,39 @@
+#include "Codec.hpp"
+
+#ifdef ICD10_WITH_LIBDEFLATE
+#include <memory>
+#include <libdeflate.h>
+
+using namespace std;
+
+namespace {
+	// libdeflate works on whole buffers in one call, which is exactly how the pipeline uses a codec.  Its compressors and
+	// decompressors aren't thread safe, so each call gets its own.  It always ends with a final block, so it can't produce
+	// fragments for splicing
+	class LibdeflateCodec : public Codec {
+	public:
+		const char *name() const override { return "libdeflate"; }
+
+		bool deflate(const char *data, size_t len, string &outp, int level) const override {
+			const unique_ptr<libdeflate_compressor, decltype(&libdeflate_free_compressor)> compressor(libdeflate_alloc_compressor(level), libdeflate_free_compressor);
+			if (!compressor) return false;
+			outp.resize(libdeflate_deflate_compress_bound(compressor.get(), len));
+			const size_t size = libdeflate_deflate_compress(compressor.get(), data, len, outp.data(), outp.size());
+			outp.resize(size);
+			return size != 0 || len == 0;
+		}
+
+		bool inflate(const char *data, size_t len, string &outp) const override {
+			const unique_ptr<libdeflate_decompressor, decltype(&libdeflate_free_decompressor)> decompressor(libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+			if (!decompressor) return false;
+			// With no actual size to report back, anything but exactly outp.size() bytes is an error
+			return libdeflate_deflate_decompress(decompressor.get(), data, len, outp.data(), outp.size(), nullptr) == LIBDEFLATE_SUCCESS;
+		}
+	};
+}
+
+const Codec &libdeflate_codec() {
+	static const LibdeflateCodec codec;
+	return codec;
+}
+#endif
@@ -0,0 +1,71 @@
+#include "Codec.hpp"
+
+#ifdef ICD10_WITH_ZLIB_NG
+#include <cstdint>
+// zlib-ng's native API (zng_ prefixed), so it can be linked alongside the stock zlib that libzip uses.  It can't share a
+// translation unit with zlib.h
+#include <zlib-ng.h>
+
+using namespace std;
+
+namespace {
+	class ZlibNgCodec : public Codec {
+	public:
+		const char *name() const override { return "zlib-ng"; }
+
+		bool deflate(const char *data, size_t len, string &outp, int level) const override {
+			if (len > UINT32_MAX) return false;
+			zng_stream strm {};
+			if (zng_deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+			outp.resize(zng_deflateBound(&strm, static_cast<unsigned long>(len)));
+			strm.next_in = reinterpret_cast<const uint8_t *>(data);
+			strm.avail_in = static_cast<uint32_t>(len);
+			strm.next_out = reinterpret_cast<uint8_t *>(outp.data());
+			strm.avail_out = static_cast<uint32_t>(outp.size());
+			const int res = zng_deflate(&strm, Z_FINISH);
+			outp.resize(strm.total_out);
+			zng_deflateEnd(&strm);
+			return res == Z_STREAM_END;
+		}
+
+		bool deflate_part(const char *data, size_t len, string &outp, int level) const override {
+			if (len > UINT32_MAX) return false;
+			zng_stream strm {};
+			if (zng_deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+			// The bound is for a finished stream; the sync flush's empty stored block can be a few bytes more than the final
+			// block it replaces
+			outp.resize(zng_deflateBound(&strm, static_cast<unsigned long>(len)) + 16);
+			strm.next_in = reinterpret_cast<const uint8_t *>(data);
+			strm.avail_in = static_cast<uint32_t>(len);
+			strm.next_out = reinterpret_cast<uint8_t *>(outp.data());
+			strm.avail_out = static_cast<uint32_t>(outp.size());
+			const int res = zng_deflate(&strm, Z_SYNC_FLUSH);
+			const bool done = res == Z_OK && strm.avail_in == 0 && strm.avail_out != 0;
+			outp.resize(strm.total_out);
+			zng_deflateEnd(&strm);
+			return done;
+		}
+
+		bool can_deflate_parts() const override { return true; }
+
+		bool inflate(const char *data, size_t len, string &outp) const override {
+			if (len > UINT32_MAX || outp.size() > UINT32_MAX) return false;
+			zng_stream strm {};
+			if (zng_inflateInit2(&strm, -15) != Z_OK) return false;
+			strm.next_in = reinterpret_cast<const uint8_t *>(data);
+			strm.avail_in = static_cast<uint32_t>(len);
+			strm.next_out = reinterpret_cast<uint8_t *>(outp.data());
+			strm.avail_out = static_cast<uint32_t>(outp.size());
+			const int res = zng_inflate(&strm, Z_FINISH);
+			const bool exact = strm.total_out == outp.size();
+			zng_inflateEnd(&strm);
+			return res == Z_STREAM_END && exact;
+		}
+	};
+}
+
+const Codec &zlib_ng_codec() {
+	static const ZlibNgCodec codec;
+	return codec;
+}
+#endif
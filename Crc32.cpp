@@ -0,0 +1,230 @@
+#include "Crc32.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC32_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CRC32_ARM
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#include <arm64_neon.h>
+#else
+#include <arm_acle.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+	constexpr uint32_t POLY = 0xedb88320; // 0x04c11db7, bit reversed
+
+	// tables[0] is the classic byte-at-a-time table; tables[k] advances a byte through k more bytes of zeros, so eight
+	// bytes can be folded in at once
+	constexpr array<array<uint32_t, 256>, 8> make_tables() {
+		array<array<uint32_t, 256>, 8> tables {};
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+			tables[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; i++) {
+			for (size_t k = 1; k < 8; k++) tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+		}
+		return tables;
+	}
+	constexpr array<array<uint32_t, 256>, 8> tables = make_tables();
+
+	// All of the kernels work on the inverted register; update does the inversion on the way in and out
+	uint32_t slice8(uint32_t crc, const unsigned char *buf, size_t len) {
+		for (; len && (reinterpret_cast<uintptr_t>(buf) & 7); len--) crc = (crc >> 8) ^ tables[0][(crc ^ *buf++) & 0xff];
+		for (; len >= 8; len -= 8, buf += 8) {
+			// Assembled byte by byte, so this doesn't care about the host's endianness
+			const uint32_t lo = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | static_cast<uint32_t>(buf[3]) << 24);
+			const uint32_t hi = buf[4] | buf[5] << 8 | buf[6] << 16 | static_cast<uint32_t>(buf[7]) << 24;
+			crc = tables[7][lo & 0xff] ^ tables[6][(lo >> 8) & 0xff] ^ tables[5][(lo >> 16) & 0xff] ^ tables[4][lo >> 24] ^
+				tables[3][hi & 0xff] ^ tables[2][(hi >> 8) & 0xff] ^ tables[1][(hi >> 16) & 0xff] ^ tables[0][hi >> 24];
+		}
+		for (; len; len--) crc = (crc >> 8) ^ tables[0][(crc ^ *buf++) & 0xff];
+		return crc;
+	}
+
+#ifdef CRC32_X86
+#if defined(__GNUC__) || defined(__clang__)
+#define CRC32_TARGET __attribute__((target("pclmul,sse4.1")))
+#else
+#define CRC32_TARGET
+#endif
+	// Four 128-bit lanes are folded forward 64 bytes at a time, then into one lane, then Barrett-reduced to 32 bits.  The
+	// constants are x^n mod P (bit reversed) for the fold distances, from Intel's "Fast CRC Computation for Generic
+	// Polynomials Using PCLMULQDQ Instruction".  Needs len >= 64; only whole 16 byte blocks are taken, and the rest is left
+	// for the caller
+	CRC32_TARGET uint32_t fold(uint32_t crc, const unsigned char *&buf, size_t &len) {
+		alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+		alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+		alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+		alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+		__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+		x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buf)), _mm_cvtsi32_si128(static_cast<int>(crc)));
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 16));
+		x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 32));
+		x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 48));
+		buf += 64;
+		len -= 64;
+
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+		for (; len >= 64; buf += 64, len -= 64) {
+			x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+			x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+			x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+			x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+			x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf)));
+			x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 16)));
+			x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 32)));
+			x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 48)));
+		}
+
+		// Four lanes into one
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+		for (__m128i next : {x2, x3, x4}) {
+			x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+		}
+		for (; len >= 16; buf += 16, len -= 16) {
+			x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf))), x5);
+		}
+
+		// 128 bits to 64
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+		x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+		x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		// Barrett reduction to 32
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x10);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, x3), x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+		return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+	}
+
+	uint32_t pclmul(uint32_t crc, const unsigned char *buf, size_t len) {
+		if (len >= 64) crc = fold(crc, buf, len);
+		return slice8(crc, buf, len);
+	}
+
+	bool has_pclmul() {
+		// CPUID leaf 1, ECX: bit 1 is PCLMULQDQ, bit 19 is SSE4.1
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 1)) && (info[2] & (1 << 19));
+#else
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+	}
+#endif
+
+#ifdef CRC32_ARM
+	// The CRC32 instructions are optional in ARMv8.0, so a plain -march=armv8-a build doesn't enable them.  The kernel is
+	// built for them on its own and only picked once has_crc32 has seen them.  Older clang only declares the ACLE
+	// intrinsics when the whole file is built with them, so it calls the builtins underneath
+#if defined(__clang__)
+#define CRC32_TARGET __attribute__((target("crc")))
+#define CRC32_B __builtin_arm_crc32b
+#define CRC32_D __builtin_arm_crc32d
+#elif defined(__GNUC__)
+#define CRC32_TARGET __attribute__((target("+crc")))
+#define CRC32_B __crc32b
+#define CRC32_D __crc32d
+#else
+#define CRC32_TARGET
+#define CRC32_B __crc32b
+#define CRC32_D __crc32d
+#endif
+	// __crc32* are the zip polynomial (the __crc32c* ones are Castagnoli), one instruction per 8 bytes
+	CRC32_TARGET uint32_t armv8(uint32_t crc, const unsigned char *buf, size_t len) {
+		for (; len && (reinterpret_cast<uintptr_t>(buf) & 7); len--) crc = CRC32_B(crc, *buf++);
+		for (; len >= 8; len -= 8, buf += 8) {
+			uint64_t word;
+			memcpy(&word, buf, 8);
+			crc = CRC32_D(crc, word);
+		}
+		for (; len; len--) crc = CRC32_B(crc, *buf++);
+		return crc;
+	}
+
+	bool has_crc32() {
+#if defined(__ARM_FEATURE_CRC32)
+		// Built for CPUs that all have them
+		return true;
+#elif defined(_MSC_VER)
+		return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != 0;
+#elif defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+		int present = 0;
+		size_t size = sizeof(present);
+		return sysctlbyname("hw.optional.armv8_crc32", &present, &size, nullptr, 0) == 0 && present;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	using Kernel = uint32_t (*)(uint32_t, const unsigned char *, size_t);
+
+	struct Dispatch {
+		Kernel run;
+		const char *name;
+	};
+
+	const Dispatch &dispatch() {
+		static const Dispatch chosen = [] {
+#if defined(CRC32_X86)
+			if (has_pclmul()) return Dispatch {pclmul, "pclmul"};
+#elif defined(CRC32_ARM)
+			if (has_crc32()) return Dispatch {armv8, "armv8"};
+#endif
+			return Dispatch {slice8, "portable"};
+		}();
+		return chosen;
+	}
+}
+
+uint32_t Crc32::update(uint32_t crc, const void *data, size_t len) {
+	return ~dispatch().run(~crc, static_cast<const unsigned char *>(data), len);
+}
+
+uint32_t Crc32::portable(uint32_t crc, const void *data, size_t len) {
+	return ~slice8(~crc, static_cast<const unsigned char *>(data), len);
+}
+
+const char *Crc32::kernel() {
+	return dispatch().name;
+}
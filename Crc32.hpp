@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// CRC-32 with the zip/zlib polynomial, so the results match zlib's crc32 and the CRC stored in zip headers.  update picks
+// the fastest kernel the CPU has the first time it's called, checking the CPU at runtime rather than trusting the build
+// flags: carry-less multiply folding (PCLMULQDQ) on x86, the CRC32 instructions on ARMv8, and slicing-by-8 tables
+// everywhere else.  crc is the running value from a previous call, or 0 to start
+class Crc32 {
+public: // API methods and constructors should be public
+	static uint32_t update(uint32_t crc, const void *data, size_t len);
+	static uint32_t update(uint32_t crc, const std::string &data) { return update(crc, data.data(), data.size()); }
+	static uint32_t portable(uint32_t crc, const void *data, size_t len); // Always the table kernel, for comparison
+	static const char *kernel(); // "pclmul", "armv8", or "portable"
+};
@@ -9,8 +9,17 @@
 #include <chrono>
 #include <iomanip>
 #include <filesystem>
-#include <thread>
 #include <utility>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <memory>
+#include <atomic>
+#include <cctype>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <csignal>
 
 /****************************************************************************************************************
 * vcpkg includes
@@ -22,6 +31,11 @@
 * Local includes
 ****************************************************************************************************************/
 #include "ArgParser.hpp"
+#include "ICD10.hpp"
+#include "ThreadPool.hpp"
+#include "LocalServer.hpp"
+#include "Crc32.hpp"
+#include "Codec.hpp"
 
 /*
 * TODO:
@@ -33,7 +47,9 @@
 * vcpkg dependencies:
 * curl
 * libzippp
+* benchmark (ICD10Bench only)
 * vcpkg install curl:x86-windows curl:x86-windows-static curl:x64-windows curl:x64-windows-static libzippp:x86-windows libzippp:x86-windows-static libzippp:x64-windows libzippp:x64-windows-static
+* vcpkg install benchmark:x86-windows-static benchmark:x64-windows-static
 */
 
 /*
@@ -57,106 +73,6 @@
 using namespace std;
 
 
-/****************************************************************************************************************
-* Compile-time constants
-****************************************************************************************************************/
-constexpr char DEF_PATH[] = "."; // The default path to use for storing files downloaded and generated
-
-// Visual studio doesn't parse the variable comment correctly if you have // in the following string.  So interrupt the // with "", which get interpreted such that the string continues uninterrupted
-constexpr char CMS_BASE_URL[20] = "https:/""/www.cms.gov"; // The base of the ICD-10 URLs.  The cms.gov links are all relational, so store the base for ease of generating a full link given the end
-
-constexpr char CMS_MAIN_URL[23] = "/medicare/coding/icd10"; // The end portion of the main ICD-10 URL
-
-/******************************************************************************************************************
- * META-COMMENT:                                                                                                  *
- * It would probably be better to use icd10cm_codes_yyyy.txt instead of icd10cm_order, but the procedure says use *
- * icd10cm_order, and I haven't verified that there are no differences                                            *
- ******************************************************************************************************************/
-constexpr char ORDER_BASE[15] = "icd10cm_order_"; // The base name for the order codes file
-
-constexpr unsigned char IND_CHARS_PER_LINE = 100; // Decimal and non-decimal files are about 100 characters per code
-
-constexpr unsigned char COMB_CHARS_PER_LINE = 200; // Combined is about 200 per code
-
-constexpr unsigned char CODES_CHARS_PER_LINE = 240; // ICD-10 codes file has about one hipaa code per 240 characters
-
-constexpr int ZIP_FILE_SIZE = 3145728; // 2.5 MiB
-
-constexpr int ORDER_FILE_SIZE = 15728640; // 15 MiB
-
-/****************************************************************************************************************
-* Structs & enums
-****************************************************************************************************************/
-// Conainer for code, decimal code, and description for ICD-10 code
-struct ICDCode {
-    string code;
-    string dec_code;
-    string desc;
-};
-
-// Main program output code enumerator
-enum OutputCode : int {
-    ok,
-    easyhandle_init,
-    cms_get_failed,
-    icd10_get_failed,
-    zip_get_failed,
-    icd10_find_failed,
-    zip_find_failed,
-    extract_file_failed,
-};
-
-// This is just a package to hold all of the information to be passed between functions.
-// All of the main functions take a ProgramState by reference
-struct ProgramState {
-    CURL *easyhandle = nullptr; // The CURL easy handle for CURL queries
-    bool disp {}; // Flag to turn on or off writing output to stdout
-    string dest_path {}; // The path into which to place generated and downloaded files.  Default is DEF_PATH
-    string cms_base {}; // The base URL for the cms.gov website.  Default is CMS_BASE_URL
-    string cms_url {}; // The relational URL for the ICD-10 page on the cms.gov website.  Default is CMS_MAIN_URL
-    string icd10_url {}; // The relational URL for the current most recent tabular order ICD-10 code page
-    string zip_url {}; // The relational URL for the link to the tabular order zip file
-    string zip_fname {}; // The filename of the current tabular order zip file
-    string zip_file {}; // The current tabular order zip file (raw data)
-    string order_file {}; // The order codes file from the current zip file
-    string dec_codes {}; // Output format decimal codes file
-    string ndec_codes {}; // Output format non-decimal codes file
-    string comb_codes {}; // Output format combined (decimal and non-decimal) codes file
-    string year {}; // The year of the most recent ICD-10 codes
-    string working_data {}; // Scratch string for loading web pages into
-    int outp = OutputCode::ok; // Current output code for the program
-};
-
-/****************************************************************************************************************
-* Predeclared support functions (and one main function)
-****************************************************************************************************************/
-// Initialize a CURL easy handle
-bool init_easy_handle(ProgramState &state);
-
-// Load the zip file from fspath into state.zip_file.  Get the year from parser, if it was found; if not, derive from fspath
-bool load_zip_file(ProgramState &state, const ArgParser &parser, const filesystem::path &fspath);
-
-// Load the text file from fspath into file
-bool load_text_file(string &file, const filesystem::path &fspath);
-
-// Load the files specified in parser into state.dec_codes, state.ndec codes, and state.comb codes if possible.
-// Return 0 on success
-// Return 1 if dec codes can't be loaded
-// Return 2 if non-dec codes can't be loaded
-// Return 3 if comb codes can't be loaded
-char load_go_files(ProgramState &state, const ArgParser &parser);
-
-// Take the url from base and strip the relational URL into url
-// For example:
-// string a="https://www.cms.gov/medicare/coding/icd10", b{};
-// parse_url(a, b);
-// a == "https://www.cms.gov";
-// b == "/medicare/coding/icd10";
-bool parse_url(string &base, string &url);
-
-// Main work function used by the program.  Take state and compress dec_codes, ndec_codes, and comb_codes into zip files
-bool work(ProgramState &state);
-
 /****************************************************************************************************************
 * Small support functions (~1-liners)
 ****************************************************************************************************************/
@@ -166,6 +82,13 @@ void to_lower(string &input) { for (char &it : input) it = tolower(it); }
 // Compare ICDCodes.  Return a < b
 bool comp_icdcode(const ICDCode &a, const ICDCode &b) { return a.code < b.code; }
 
+// Read a little endian 16 or 32 bit field (as zip headers use) at pos in data
+uint16_t get_le16(const string &data, size_t pos) { return static_cast<uint16_t>(static_cast<unsigned char>(data[pos]) | static_cast<unsigned char>(data[pos + 1]) << 8); }
+uint32_t get_le32(const string &data, size_t pos) { return get_le16(data, pos) | static_cast<uint32_t>(get_le16(data, pos + 2)) << 16; }
+
+// Append the low len bytes of val to data, little endian
+void put_le(string &data, uint64_t val, int len) { for (int i = 0; i < len; i++) data.push_back(static_cast<char>(val >> (8 * i))); }
+
 // Safe cast to throw an error when causing an overflow by casting to a smaller type
 template <typename To, typename From>
 To safe_cast(const From &value) {
@@ -176,6 +99,7 @@ To safe_cast(const From &value) {
 /****************************************************************************************************************
 * Entry point (int main)
 ****************************************************************************************************************/
+#ifndef ICD10_NO_MAIN
 // Entry point for the program.  Return the OutputCode from ProgramState.outp
 int main(int argc, char *argv[]) {
     // Main function
@@ -184,6 +108,24 @@ int main(int argc, char *argv[]) {
     ArgParser parser(vector<pair<string, string>>({{"p", "path"}, {"y", "year"}, {"f", "zip-file"}, {"i", "icd10-url"}, {"z", "zip-url"}, {"o", "order-file"}, {"d", "decimal-file"}, {"n", "non-decimal-file"}, {"c", "combined-file"}, {"u", "cms-url"}}));
     parser.add_token("?", "help", false);
     parser.add_token("q", "quiet", false);
+    parser.add_token("g", "generate", false);
+    parser.add_token("", "scale", true, false);
+    parser.add_token("", "hipaa-ratio", true, false);
+    parser.add_token("", "line-ending", true, false);
+    parser.add_token("", "desc-length", true, false);
+    parser.add_token("", "profile", false);
+    parser.add_token("", "profile-json", true, false);
+    parser.add_token("", "trace", true, false);
+    parser.add_token("", "write-go", false);
+    parser.add_token("", "direct-io", false);
+    parser.add_token("", "daemon", true, false);
+    parser.add_token("", "watch", true, false);
+    parser.add_token("", "sites", true, false);
+    parser.add_token("", "no-verify", false);
+    parser.add_token("", "codec", true, false);
+    parser.add_token("", "single-archive", false);
+    parser.add_token("", "full-zip", false);
+    parser.add_token("", "offline", false);
     parser.parse(argc, argv);
     // Display usage if the help token is found
     if (parser.found("help")) {
@@ -196,7 +138,9 @@ int main(int argc, char *argv[]) {
         cout << endl;
         cout << "Attempts to get the latest ICD-10 code information from the Centers for Medicare & Medicaid Services website, format it for importing into Sunquest, and compress it for delivery to sites." << endl;
         cout << endl;
-        cout << cur_fname << " [[/p] Destination] [[/y] Year] [[/f] Zip file] [[/i] ICD-10 URL] [[/z] Zip URL] [[/o] Order file] [[/d] Decimal file [/n] Non-decimal file [/c] Combined file] [[/u] CMS URL] [/q]" << endl;
+        cout << cur_fname << " [[/p] Destination] [[/y] Year] [[/f] Zip file] [[/i] ICD-10 URL] [[/z] Zip URL] [[/o] Order file] [[/d] Decimal file [/n] Non-decimal file [/c] Combined file] [[/u] CMS URL] [/q] [--write-go] [--full-zip] [--offline] [--single-archive] [--direct-io] [--no-verify] [--codec Codec] [--daemon Socket] [--watch Seconds] [--sites Manifest] [--profile] [--profile-json File] [--trace File]" << endl;
+        cout << endl;
+        cout << cur_fname << " /g [[/p] Destination] [[/y] Year] [--scale Scale] [--hipaa-ratio Ratio] [--line-ending lf|crlf|cr] [--desc-length Length] [/q]" << endl;
         cout << endl;
         cout << cur_fname << " /?" << endl;
         cout << endl;
@@ -216,6 +160,36 @@ int main(int argc, char *argv[]) {
         cout << "                         and non-decimal format.  Must be used with /d and /n." << endl;
         cout << "  /u --cms-url           Specifies the URL to begin searching for ICD-10 codes." << endl;
         cout << "  /q --quiet             Suppress console output." << endl;
+        cout << "     --sites             Generate a variant of the files for each site in the manifest given, all from one" << endl;
+        cout << "                         parse.  One site per line: \"site name=Name [path=Directory] [dec-global=Global]" << endl;
+        cout << "                         [ndec-global=Global] [prefix=File name prefix]\".  /d, /n, and /c are ignored." << endl;
+        cout << "     --write-go          Also write the uncompressed .go files to the destination." << endl;
+        cout << "     --full-zip          Download the whole tabular order zip, rather than only the order file out of it." << endl;
+        cout << "     --offline           Never touch the network.  /f, /o, or /d, /n, and /c must supply the codes." << endl;
+        cout << "     --single-archive    Write all of the .go files into one zip file (per site) instead of one each." << endl;
+        cout << "     --codec             Deflate backend for reading and writing zip files.  Built in:";
+        for (const Codec *it : Codec::available()) cout << ' ' << it->name();
+        cout << " (default " << Codec::current().name() << ")." << endl;
+        cout << "     --no-verify         Skip re-reading the written zip files to check their CRCs and a sample of records." << endl;
+        cout << "     --direct-io         Write large output files with O_DIRECT, bypassing the page cache (Linux only)." << endl;
+        cout << "     --daemon            Stay running and generate files on request from the local socket given, keeping" << endl;
+        cout << "                         the parsed codes warm between requests.  Send \"generate [path=Directory] [year=Year]" << endl;
+        cout << "                         [format=dec|ndec|comb|all]\", \"refresh\", \"ping\", or \"shutdown\", one per line.  year=" << endl;
+        cout << "                         must be the newest release's (looked up on the CMS website if need be) or one" << endl;
+        cout << "                         already generated, or it's an unknown-year." << endl;
+        cout << "     --watch             Stay running and check the CMS website every so many seconds, generating files" << endl;
+        cout << "                         only when a new release is found.  /f, /o, /d, /n, and /c are ignored.  Ctrl+C" << endl;
+        cout << "                         (or SIGTERM) stops it once the current check is done." << endl;
+        cout << "     --profile           Print the time, bytes, allocations, and memory used by each stage when done." << endl;
+        cout << "     --profile-json      Like --profile, but write the report as JSON to the file given." << endl;
+        cout << "     --trace             Write a Chrome trace event file (for Perfetto or chrome://tracing) of every stage and" << endl;
+        cout << "                         worker thread to the file given." << endl;
+        cout << "  /g --generate          Write a synthetic order file and matching zip to the destination instead of" << endl;
+        cout << "                         generating .go files.  Uses /y for the year (default " << SYNTH_YEAR << ") and:" << endl;
+        cout << "     --scale             Size as a multiple of a real order file (default 1)." << endl;
+        cout << "     --hipaa-ratio       Fraction of codes flagged as hipaa codes (default 0.76)." << endl;
+        cout << "     --line-ending       lf, crlf, or cr (default lf)." << endl;
+        cout << "     --desc-length       Average long description length (default 100)." << endl;
         cout << "  /? --help              Displays this help file." << endl;
         cout << endl;
 
@@ -228,6 +202,17 @@ int main(int argc, char *argv[]) {
     // Create the ProgramState to pass information around by reference
     ProgramState state;
     state.disp = !parser.found("quiet");
+    state.write_go = parser.found("write-go");
+    state.direct_io = parser.found("direct-io");
+    state.verify = !parser.found("no-verify");
+    state.full_zip = parser.found("full-zip");
+    state.offline = parser.found("offline");
+    if (parser.found("single-archive")) state.archive_mode = archive_single;
+    if (parser.found("codec")) {
+        string val = parser.get_value("codec");
+        to_lower(val);
+        if (!Codec::select(val) && state.disp) cout << "Unknown codec \"" << val << "\".  Defaulting to " << Codec::current().name() << "..." << endl;
+    }
     if (state.disp) cout << endl << "ICD-10 codes update file generator:" << endl << endl;
     if (parser.found("path")) {
         state.dest_path = move(parser.get_value("path"));
@@ -255,6 +240,57 @@ int main(int argc, char *argv[]) {
         if (state.disp) cout << "Could not detect provided output path.  Defaulting to current path..." << endl;
         state.dest_path = DEF_PATH;
     }
+    if (parser.found("generate")) {
+        // Synthetic order files don't need anything from the network, so skip the rest of the validation and curl entirely
+        SynthOptions opts;
+        if (parser.found("year")) state.year = move(parser.get_value("year"));
+        if (parser.found("scale")) {
+            string val = parser.get_value("scale");
+            char *end = nullptr;
+            double scale = strtod(val.c_str(), &end);
+            if (end == val.c_str() || scale <= 0) {
+                if (state.disp) cout << "Could not parse scale \"" << val << "\".  Defaulting to 1..." << endl;
+            } else {
+                opts.scale = scale;
+            }
+        }
+        if (parser.found("hipaa-ratio")) {
+            string val = parser.get_value("hipaa-ratio");
+            char *end = nullptr;
+            double ratio = strtod(val.c_str(), &end);
+            if (end == val.c_str() || ratio < 0 || ratio > 1) {
+                if (state.disp) cout << "Could not parse hipaa ratio \"" << val << "\".  Defaulting to " << opts.hipaa_ratio << "..." << endl;
+            } else {
+                opts.hipaa_ratio = ratio;
+            }
+        }
+        if (parser.found("line-ending")) {
+            string val = parser.get_value("line-ending");
+            to_lower(val);
+            if (val == "lf") {
+                opts.line_end = "\n";
+            } else if (val == "crlf") {
+                opts.line_end = "\r\n";
+            } else if (val == "cr") {
+                opts.line_end = "\r";
+            } else if (state.disp) {
+                cout << "Unknown line ending \"" << val << "\".  Defaulting to lf..." << endl;
+            }
+        }
+        if (parser.found("desc-length")) {
+            string val = parser.get_value("desc-length");
+            char *end = nullptr;
+            unsigned long len = strtoul(val.c_str(), &end, 10);
+            if (end == val.c_str() || len == 0) {
+                if (state.disp) cout << "Could not parse description length \"" << val << "\".  Defaulting to " << opts.desc_len << "..." << endl;
+            } else {
+                opts.desc_len = len;
+            }
+        }
+        if (state.dest_path.back() != filesystem::path::preferred_separator) state.dest_path.push_back(filesystem::path::preferred_separator);
+        generate_order_file(state, opts);
+        return state.outp;
+    }
     if (parser.found("cms-url")) {
         state.cms_base = move(parser.get_value("cms-url"));
         if (!parse_url(state.cms_base, state.cms_url)) state.cms_base.clear();
@@ -386,24 +422,97 @@ int main(int argc, char *argv[]) {
         if (state.disp) cout << "Cannot load any .go files unless all 3 are loaded.  Ignoring specified .go files..." << endl;
     }
 
+    if (parser.found("sites")) {
+        string sites_fname = parser.get_value("sites");
+        string manifest, error;
+        if (!load_text_file(manifest, filesystem::path(sites_fname))) {
+            if (state.disp) cout << "Could not load site manifest \"" << sites_fname << "\".  Ignoring specified manifest..." << endl;
+        } else if (!parse_sites(manifest, state.sites, error)) {
+            if (state.disp) cout << "Could not parse site manifest (" << error << ").  Ignoring specified manifest..." << endl;
+            state.sites.clear();
+        } else if (!state.dec_codes.empty()) {
+            // Loaded .go files already have the default global names baked in, so every site needs its files generated
+            if (state.disp) cout << "Site variants are generated from the codes.  Ignoring specified .go files..." << endl;
+            state.dec_codes.clear();
+            state.ndec_codes.clear();
+            state.comb_codes.clear();
+        }
+    }
+
     /************************************************************************************************************
     * Start of main routine
     ************************************************************************************************************/
     if (state.dest_path.back() != filesystem::path::preferred_separator) state.dest_path.push_back(filesystem::path::preferred_separator);
 
-    // Global CURL init result
-    const CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
-    if (init_easy_handle(state)) {
+    unsigned int interval = DEF_WATCH_INTERVAL;
+    if (parser.found("watch")) {
+        string val = parser.get_value("watch");
+        char *end = nullptr;
+        unsigned long secs = strtoul(val.c_str(), &end, 10);
+        if (end == val.c_str() || secs == 0) {
+            if (state.disp) cout << "Could not parse watch interval \"" << val << "\".  Defaulting to " << interval << " seconds..." << endl;
+        } else {
+            interval = static_cast<unsigned int>(secs);
+        }
+    }
+
+    // Only create the profiler if it was asked for; every stage checks for a null profiler and does nothing
+    unique_ptr<Profiler> profiler;
+    if (parser.found("profile") || parser.found("profile-json") || parser.found("trace")) {
+        profiler = make_unique<Profiler>();
+        state.profiler = profiler.get();
+    }
+    // Likewise the progress reporter, which /q turns off, reporter thread and all
+    unique_ptr<Progress> progress;
+    if (state.disp) {
+        progress = make_unique<Progress>(cout);
+        state.progress = progress.get();
+    }
+
+    // Neither curl nor the easy handle is set up until something needs the network (see start_network), so a run from
+    // local files never initializes TLS or the resolver
+    {
+        // The loop has to be gone before the easy handle is cleaned up
+        EventLoop loop;
+        state.loop = &loop;
         // Put the work into a separate function so it can return early and we can stil clean up afterwards
-        work(state);
-        curl_easy_cleanup(state.easyhandle);
-    } else {
-        cerr << "Could not acquire curl easy handle!" << endl;
-        state.outp = OutputCode::easyhandle_init;
+        if (parser.found("daemon")) serve(state, parser.get_value("daemon"));
+        else if (parser.found("watch")) watch(state, interval);
+        else work(state);
+        state.loop = nullptr;
     }
+    if (state.easyhandle) curl_easy_cleanup(state.easyhandle);
+    // Does nothing if curl was never initialized
     curl_global_cleanup();
+    // Stop reporting before anything else is written to stdout
+    state.progress = nullptr;
+    progress.reset();
+
+    if (profiler) {
+        // The report was asked for explicitly, so it's shown even with /q
+        if (parser.found("profile")) profiler->report_table(cout);
+        if (parser.found("profile-json")) {
+            string json_fname = parser.get_value("profile-json");
+            ofstream json_file(json_fname, ios::out | ios::trunc);
+            if (json_file) {
+                profiler->report_json(json_file);
+            } else {
+                cerr << "Could not write profile to \"" << json_fname << "\"!" << endl;
+            }
+        }
+        if (parser.found("trace")) {
+            string trace_fname = parser.get_value("trace");
+            ofstream trace_file(trace_fname, ios::out | ios::trunc);
+            if (trace_file) {
+                profiler->report_trace(trace_file);
+            } else {
+                cerr << "Could not write trace to \"" << trace_fname << "\"!" << endl;
+            }
+        }
+    }
     return state.outp;
 }
+#endif // ICD10_NO_MAIN
 
 /****************************************************************************************************************
 * Support funcctions
@@ -420,11 +529,339 @@ size_t receive_data(char *data, size_t size, size_t nmemb, string *userdata) {
     return received_size;
 }
 
+// Feed a web page into the LinkScanner in userdata as it arrives
+size_t receive_page(char *data, size_t size, size_t nmemb, LinkScanner *userdata) {
+    // Support function
+    scan_chunk(*userdata, data, nmemb);
+    // Taking less than the whole chunk stops the transfer; the rest of the page can't change what was found
+    return userdata->done ? 0 : size * nmemb;
+}
+
+// Report how much of a download has been received to the Progress in clientp
+int download_progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t, curl_off_t) {
+    // Support function
+    Progress *progress = static_cast<Progress *>(clientp);
+    progress->set(Progress::download_size, static_cast<uint64_t>(dltotal));
+    progress->set(Progress::downloaded, static_cast<uint64_t>(dlnow));
+    return 0;
+}
+
+Async<CURLcode> perform_async(EventLoop &loop, CURL *easyhandle) {
+    // Support function
+    co_return co_await loop.fetch(easyhandle);
+}
+
+Async<bool> probe_zip_links(EventLoop &loop, vector<CURL *> handles, vector<string> urls, size_t &hit) {
+    // Support function
+    hit = string::npos;
+    vector<Async<CURLcode>> probes;
+    for (size_t i = 0; i < urls.size(); i++) {
+        curl_easy_setopt(handles[i], CURLOPT_URL, urls[i].c_str());
+        curl_easy_setopt(handles[i], CURLOPT_NOBODY, 1L);
+        probes.push_back(perform_async(loop, handles[i]));
+        probes.back().start();
+    }
+    // A url wins only once every one preferred over it is known to be missing
+    size_t next = 0;
+    while (next < probes.size()) {
+        const CURLcode res = co_await move(probes[next]);
+        long status = 0;
+        if (res == CURLE_OK) curl_easy_getinfo(handles[next], CURLINFO_RESPONSE_CODE, &status);
+        if (status == 200) hit = next;
+        next++;
+        if (hit != string::npos) break;
+    }
+    // The ones that lost aren't needed any more
+    for (size_t i = next; i < probes.size(); i++) loop.cancel(handles[i]);
+    for (size_t i = next; i < probes.size(); i++) co_await move(probes[i]);
+    co_return hit != string::npos;
+}
+
+Async<bool> fetch_predicted_zip(EventLoop &loop, vector<CURL *> handles, vector<string> urls, vector<string> entries, bool full, const bool &stop, const string &listed, size_t &hit, string &outp, bool &rebuilt) {
+    // Support function
+    const bool found = co_await probe_zip_links(loop, handles, urls, hit);
+    // The page may have been read while the probes ran
+    if (!found || stop || (!listed.empty() && listed != urls[hit])) co_return false;
+    curl_easy_setopt(handles[hit], CURLOPT_HTTPGET, 1L);
+    const CURLcode res = co_await download_zip(loop, handles[hit], urls[hit], entries[hit], full, stop, outp, rebuilt);
+    co_return res == CURLE_OK;
+}
+
+CURLcode traced_perform(ProgramState &state) {
+    // Support function
+    TraceSpan span(state.profiler, "curl perform");
+    return state.loop->run(perform_async(*state.loop, state.easyhandle));
+}
+
+Async<bool> stage_file_async(EventLoop &loop, OutputWriter &writer, string fname, const string &data, Profiler *profiler) {
+    // Support function
+    bool written = false;
+    co_await loop.offload([&] {
+        TraceSpan span(profiler, "write file");
+        // Through an OutputWriter so the file is published atomically, rather than truncated and rewritten in place
+        writer.add_ref(fname, data);
+        written = writer.stage();
+    });
+    co_return written;
+}
+
+CURLcode scan_page(ProgramState &state, const string &url, LinkScanner &scanner) {
+    // Support function
+    // An empty list offers every encoding curl can decode, and curl decodes the body before it reaches receive_page
+    curl_easy_setopt(state.easyhandle, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEFUNCTION, receive_page);
+    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &scanner);
+    curl_easy_setopt(state.easyhandle, CURLOPT_URL, url.c_str());
+    CURLcode res = traced_perform(state);
+    curl_off_t wire = 0;
+    curl_easy_getinfo(state.easyhandle, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+    scanner.wire_bytes = static_cast<uint64_t>(wire);
+
+    // The handle is shared with the rest of the program, so put it back to plain transfers into a string.  The zip's
+    // range requests in particular have to be for the zip's own bytes
+    curl_easy_setopt(state.easyhandle, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEFUNCTION, receive_data);
+    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &state.working_data);
+    // Stopped by receive_page once the link was settled
+    if (res == CURLE_WRITE_ERROR && scanner.done) res = CURLE_OK;
+    return res;
+}
+
+long conditional_fetch(ProgramState &state, const string &url, HttpValidator &validator, bool head) {
+    // Support function
+    curl_slist *headers = nullptr;
+    if (!validator.etag.empty()) headers = curl_slist_append(headers, ("If-None-Match: " + validator.etag).c_str());
+    if (!validator.last_modified.empty()) headers = curl_slist_append(headers, ("If-Modified-Since: " + validator.last_modified).c_str());
+
+    state.working_data.clear();
+    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &state.working_data);
+    curl_easy_setopt(state.easyhandle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(state.easyhandle, CURLOPT_HTTPHEADER, headers);
+    if (head) curl_easy_setopt(state.easyhandle, CURLOPT_NOBODY, 1L);
+    // Pages come compressed if the server will do it.  The zip is only ever asked for its headers here
+    else curl_easy_setopt(state.easyhandle, CURLOPT_ACCEPT_ENCODING, "");
+    const CURLcode res = traced_perform(state);
+
+    long status = 0;
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(state.easyhandle, CURLINFO_RESPONSE_CODE, &status);
+    } else {
+        cerr << "Easy perform failed to get \"" << url << "\": " << curl_easy_strerror(res) << endl;
+    }
+    if (status == 200) {
+        curl_header *found = nullptr;
+        validator.etag = curl_easy_header(state.easyhandle, "ETag", 0, CURLH_HEADER, -1, &found) == CURLHE_OK ? found->value : "";
+        validator.last_modified = curl_easy_header(state.easyhandle, "Last-Modified", 0, CURLH_HEADER, -1, &found) == CURLHE_OK ? found->value : "";
+        curl_off_t length = -1;
+        curl_easy_getinfo(state.easyhandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        validator.length = length;
+    }
+
+    // The handle is shared with the rest of the program, so put it back to plain GETs
+    curl_easy_setopt(state.easyhandle, CURLOPT_HTTPHEADER, nullptr);
+    if (head) curl_easy_setopt(state.easyhandle, CURLOPT_HTTPGET, 1L);
+    else curl_easy_setopt(state.easyhandle, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_slist_free_all(headers);
+    return status;
+}
+
+Async<long> range_fetch(EventLoop &loop, CURL *easy, string url, string range, const bool &stop, string &outp, uint64_t &total) {
+    // Support function
+    outp.clear();
+    total = 0;
+    if (stop) co_return 0;
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &outp);
+    curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(easy, CURLOPT_RANGE, range.c_str());
+    const CURLcode res = co_await loop.fetch(easy);
+    // The handle may be shared with the rest of the program, so put it back to whole transfers
+    curl_easy_setopt(easy, CURLOPT_RANGE, nullptr);
+    if (res != CURLE_OK) co_return 0;
+
+    long status = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    if (status != 206) co_return status;
+    // Content-Range: bytes first-last/total.  A total of * (unknown) is no use for working out where a suffix starts
+    curl_header *found = nullptr;
+    if (curl_easy_header(easy, "Content-Range", 0, CURLH_HEADER, -1, &found) != CURLHE_OK) co_return 0;
+    const string value {found->value};
+    const size_t slash = value.rfind('/');
+    if (slash == string::npos || slash + 1 == value.size() || !isdigit(static_cast<unsigned char>(value[slash + 1]))) co_return 0;
+    total = strtoull(value.c_str() + slash + 1, nullptr, 10);
+    co_return status;
+}
+
+Async<bool> fetch_zip_entry(EventLoop &loop, CURL *easy, string url, string entry_name, const bool &stop, string &outp, bool &rebuilt) {
+    // Support function
+    rebuilt = false;
+    const auto range = [](uint64_t first, uint64_t len) { return to_string(first) + "-" + to_string(first + len - 1); };
+    uint64_t total = 0;
+
+    // The end of central directory record is the last 22 bytes, followed by at most 64 KiB of comment
+    string tail;
+    const long status = co_await range_fetch(loop, easy, url, "-" + to_string(22 + 0xffff), stop, tail, total);
+    if (status == 200) {
+        // The server ignored the range and sent the whole archive, which is just as good
+        outp = move(tail);
+        co_return true;
+    }
+    if (status != 206 || total < tail.size()) co_return false;
+    const uint64_t tail_start = total - tail.size();
+    const size_t eocd = find_eocd(tail);
+    if (eocd == string::npos) co_return false;
+    const uint16_t entries = get_le16(tail, eocd + 10);
+    const uint64_t central_size = get_le32(tail, eocd + 12), central = get_le32(tail, eocd + 16);
+    if (entries == 0xffff || central == 0xffffffff || central + central_size > tail_start + eocd) co_return false;
+
+    // The central directory usually came with the tail
+    string dir;
+    if (central >= tail_start) {
+        dir = tail.substr(central - tail_start, central_size);
+    } else {
+        const long dir_status = co_await range_fetch(loop, easy, url, range(central, central_size), stop, dir, total);
+        if (dir_status != 206 || dir.size() != central_size) co_return false;
+    }
+    tail.clear();
+
+    // Find the entry the way uncompress_data will: the first whose lower-cased name ends with entry_name, so one in a
+    // folder or named in another case is still found.  Its data (and data descriptor, if it has one) runs up to the next
+    // entry's local header, or the central directory if it's the last one
+    string wanted {entry_name};
+    to_lower(wanted);
+    size_t record = string::npos, record_len = 0;
+    uint64_t offset = 0, end = central;
+    vector<uint64_t> offsets;
+    offsets.reserve(entries);
+    for (size_t pos = 0, i = 0; i < entries; i++) {
+        if (pos + 46 > dir.size() || get_le32(dir, pos) != 0x02014b50) co_return false;
+        const size_t len = 46 + get_le16(dir, pos + 28) + get_le16(dir, pos + 30) + get_le16(dir, pos + 32);
+        if (pos + len > dir.size()) co_return false;
+        offsets.push_back(get_le32(dir, pos + 42));
+        string name = dir.substr(pos + 46, get_le16(dir, pos + 28));
+        to_lower(name);
+        if (record == string::npos && name.ends_with(wanted) && name.back() != '/') {
+            record = pos;
+            record_len = len;
+            offset = offsets.back();
+        }
+        pos += len;
+    }
+    // Zip64 sizes and offsets would have to be rewritten in the extra field; those archives are fetched whole
+    if (record == string::npos || offset == 0xffffffff || get_le32(dir, record + 20) == 0xffffffff) co_return false;
+    for (const uint64_t it : offsets) {
+        if (it > offset && it < end) end = it;
+    }
+
+    string entry;
+    const long entry_status = co_await range_fetch(loop, easy, url, range(offset, end - offset), stop, entry, total);
+    if (entry_status != 206 || entry.size() != end - offset) co_return false;
+    if (entry.size() < 30 || get_le32(entry, 0) != 0x04034b50) co_return false;
+
+    // Rebuild a one-entry archive around it: the local header and data as fetched, the entry's central directory record
+    // pointing at offset 0, and a new end of central directory record
+    outp = move(entry);
+    const size_t new_central = outp.size();
+    outp.append(dir, record, record_len);
+    outp.replace(new_central + 42, 4, 4, '\0');
+    put_le(outp, 0x06054b50, 4);
+    put_le(outp, 0, 2); // This disk
+    put_le(outp, 0, 2); // Central directory disk
+    put_le(outp, 1, 2); // Entries on this disk
+    put_le(outp, 1, 2); // Entries
+    put_le(outp, record_len, 4);
+    put_le(outp, new_central, 4);
+    put_le(outp, 0, 2); // Comment length
+    rebuilt = true;
+    co_return true;
+}
+
+Async<CURLcode> download_zip(EventLoop &loop, CURL *easy, string url, string entry_name, bool full, const bool &stop, string &outp, bool &rebuilt) {
+    // Support function
+    rebuilt = false;
+    // Only the order file is needed out of the bundle, so unless the whole zip was asked for, try fetching just that entry
+    // with range requests first
+    if (!full) {
+        const bool fetched = co_await fetch_zip_entry(loop, easy, url, entry_name, stop, outp, rebuilt);
+        if (fetched) co_return CURLE_OK;
+    }
+    if (stop) co_return CURLE_ABORTED_BY_CALLBACK;
+    // Estimate ZIP_FILE_SIZE for the zip file
+    outp.clear();
+    outp.reserve(ZIP_FILE_SIZE);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &outp);
+    curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+    const CURLcode res = co_await loop.fetch(easy);
+    // Return the extra space if the estimate was too big
+    outp.shrink_to_fit();
+    co_return res;
+}
+
+void copy_settings(const ProgramState &from, ProgramState &to) {
+    // Support function
+    to.easyhandle = from.easyhandle;
+    to.disp = from.disp;
+    to.loop = from.loop;
+    to.profiler = from.profiler;
+    to.dest_path = from.dest_path;
+    to.cms_base = from.cms_base;
+    to.cms_url = from.cms_url;
+    to.icd10_url = from.icd10_url;
+    to.zip_url = from.zip_url;
+    to.year = from.year;
+    to.write_go = from.write_go;
+    to.direct_io = from.direct_io;
+    to.go_files = from.go_files;
+    to.sites = from.sites;
+    to.verify = from.verify;
+    to.archive_mode = from.archive_mode;
+    to.offline = from.offline;
+    to.full_zip = from.full_zip;
+    to.progress = from.progress;
+}
+
+bool finish_zip_save(ProgramState &state) {
+    // Support function
+    if (!state.zip_save) return true;
+    // Saving overlaps everything since the download, so this stage is only the part of it that's left at the end
+    ProfileStage stage(state.profiler, "save");
+    bool saved = state.loop->run(*state.zip_save->task);
+    // A failed run leaves nothing behind in the destination, the zip included
+    if (state.outp != OutputCode::ok) state.zip_save->writer.discard();
+    else if (saved) saved = state.zip_save->writer.publish();
+    if (!saved) cerr << "Unable to save zip file to \"" << state.zip_save->path << "\"!" << endl;
+    stage.bytes(state.zip_save->data.size(), state.zip_save->data.size());
+    state.zip_save.reset();
+    return saved;
+}
+
+void show_status(const ProgramState &state, const string &text) {
+    // Support function
+    if (state.progress) state.progress->message(text);
+    else if (state.disp) cout << text << '\n';
+}
+
+bool start_network(ProgramState &state) {
+    // Support function
+    if (state.easyhandle) return true;
+    if (state.offline) {
+        cerr << "The network is needed, but --offline was given!" << endl;
+        state.outp = OutputCode::offline;
+        return false;
+    }
+    // Only ever done once, since the handle is kept for the rest of the run, so main's one cleanup matches it
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK || !init_easy_handle(state)) {
+        cerr << "Could not acquire curl easy handle!" << endl;
+        state.outp = OutputCode::easyhandle_init;
+        return false;
+    }
+    return true;
+}
+
 bool init_easy_handle(ProgramState &state) {
     // Support function
     state.easyhandle = curl_easy_init();
     if (state.easyhandle) {
-        curl_easy_setopt(state.easyhandle, CURLOPT_NOPROGRESS);
+        curl_easy_setopt(state.easyhandle, CURLOPT_NOPROGRESS, 1L);
         curl_easy_setopt(state.easyhandle, CURLOPT_WRITEFUNCTION, receive_data);
     } else {
         return false;
@@ -432,8 +869,48 @@ bool init_easy_handle(ProgramState &state) {
     return true;
 }
 
-// Uncompress the file fname from the zip file held in data into outp
 bool uncompress_data(const string &data, const string &fname, string &outp) {
+    // Support function
+    // Read the central directory directly and inflate with the current codec.  Anything that isn't a plain stored or
+    // deflated entry (zip64, encryption, other methods) goes through libzip instead
+    const size_t eocd = find_eocd(data);
+    if (eocd == string::npos) return false;
+    const uint16_t entries = get_le16(data, eocd + 10);
+    size_t central = get_le32(data, eocd + 16);
+    if (entries == 0xffff || central == 0xffffffff) return uncompress_data_libzip(data, fname, outp);
+    for (uint16_t i = 0; i < entries; i++) {
+        if (central + 46 > data.size() || get_le32(data, central) != 0x02014b50) return false;
+        const uint16_t name_len = get_le16(data, central + 28);
+        if (central + 46 + name_len > data.size()) return false;
+        string name = data.substr(central + 46, name_len);
+        to_lower(name);
+        if (!name.ends_with(fname) || name.back() == '/') {
+            central += 46 + name_len + get_le16(data, central + 30) + get_le16(data, central + 32);
+            continue;
+        }
+
+        const uint16_t flags = get_le16(data, central + 8), method = get_le16(data, central + 10);
+        const uint32_t crc = get_le32(data, central + 16), comp_size = get_le32(data, central + 20), size = get_le32(data, central + 24);
+        const size_t local = get_le32(data, central + 42);
+        if ((flags & 1) || (method != 0 && method != 8) || comp_size == 0xffffffff || size == 0xffffffff || local == 0xffffffff) {
+            return uncompress_data_libzip(data, fname, outp);
+        }
+        if (local + 30 > data.size() || get_le32(data, local) != 0x04034b50) return false;
+        // The local header's name and extra field can differ in length from the central directory's
+        const size_t start = local + 30 + get_le16(data, local + 26) + get_le16(data, local + 28);
+        if (start + comp_size > data.size()) return false;
+        if (method == 0) {
+            outp.assign(data, start, comp_size);
+        } else {
+            outp.resize(size);
+            if (!Codec::current().inflate(data.data() + start, comp_size, outp)) return false;
+        }
+        return outp.size() == size && Crc32::update(0, outp) == crc;
+    }
+    return false;
+}
+
+bool uncompress_data_libzip(const string &data, const string &fname, string &outp) {
     // Support function
     using namespace libzippp;
     ZipArchive *zip_arch = ZipArchive::fromBuffer(data.c_str(), safe_cast<uint32_t>(data.length()));
@@ -448,9 +925,12 @@ bool uncompress_data(const string &data, const string &fname, string &outp) {
             }
         }
         if (zip_fil.isNull() || !zip_fil.isFile()) {
+            ZipArchive::free(zip_arch);
             return false;
         }
         outp = move(zip_fil.readAsText());
+        // The archive holds its own view of data; release it now rather than leaking it for the life of the program
+        ZipArchive::free(zip_arch);
         return true;
     }
     return false;
@@ -470,25 +950,255 @@ void compress_data2(const string &data, string fname, string ext, char *outp, ui
     }
 }
 
-// Store data into a file named fname+ext, then compress the file into base_path+fname+".zip"
-void compress_data(const string &data, string &base_path, string fname, string ext) {
+size_t find_record(const string &data, size_t lo, size_t hi, const string &prefix, const string &key) {
+    // Support function
+    // Records are sorted by key, so binary search on byte offsets.  Each step looks at the first record that starts at or
+    // after the midpoint
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const size_t pos = data.find(prefix, mid);
+        if (pos == string::npos || pos >= hi) {
+            hi = mid;
+            continue;
+        }
+        const size_t key_start = pos + prefix.size();
+        const size_t key_end = data.find('"', key_start);
+        if (key_end == string::npos) return string::npos;
+        const int cmp = data.compare(key_start, key_end - key_start, key);
+        if (cmp == 0) return pos + 1;
+        if (cmp < 0) lo = key_end;
+        else hi = mid;
+    }
+    return string::npos;
+}
+
+bool verify_archive(const VerifyJob &job, const vector<ICDCode> &sample, uint64_t &size, string &error) {
     // Support function
     using namespace libzippp;
-    string zip_name = base_path + fname + ".zip", fil_name = fname + ext;
-    ZipArchive zip_arch(zip_name);
-    if (zip_arch.open(ZipArchive::NEW)) {
-        if (zip_arch.addData(fil_name, data.c_str(), data.length())) {
-            ZipEntry zip_fil = zip_arch.getEntry(fil_name);
-            zip_fil.setCompressionEnabled(true);
+    string archive;
+    {
+        ifstream fil(job.zip_path, ios::binary | ios::in | ios::ate);
+        if (!fil) {
+            error = "could not be opened";
+            return false;
+        }
+        archive.resize(static_cast<size_t>(fil.tellg()));
+        fil.seekg(0);
+        if (!fil.read(archive.data(), archive.size())) {
+            error = "could not be read";
+            return false;
+        }
+    }
+    size = archive.size();
+
+    // Structure: exactly the entries it was written with, one of them this one
+    ZipArchive *zip_arch = ZipArchive::fromBuffer(archive.data(), safe_cast<uint32_t>(archive.size()));
+    if (zip_arch == nullptr) {
+        error = "not a readable zip archive";
+        return false;
+    }
+    const vector<ZipEntry> entries = zip_arch->getEntries();
+    const auto entry = find_if(entries.begin(), entries.end(), [&](const ZipEntry &it) { return it.getName() == job.entry_name; });
+    if (entries.size() != job.entries || entry == entries.end() || !entry->isFile()) {
+        ZipArchive::free(zip_arch);
+        error = "expected " + to_string(job.entries) + (job.entries == 1 ? " entry" : " entries") + ", one named \"" + job.entry_name + "\"";
+        return false;
+    }
+    const string data = entry->readAsText();
+    const uint64_t expected_size = entry->getSize();
+    const uint32_t expected_crc = static_cast<uint32_t>(entry->getCRC());
+    ZipArchive::free(zip_arch);
+    if (data.size() != expected_size) {
+        error = "entry is " + to_string(data.size()) + " bytes; the header says " + to_string(expected_size);
+        return false;
+    }
+    if (Crc32::update(0, data) != expected_crc) {
+        error = "CRC mismatch";
+        return false;
+    }
+    // Generated files end with the "\n\n" footer, but loaded ones can end any way at all, so it's checked against the
+    // file's own end
+    if (!data.ends_with(job.tail)) {
+        error = "entry is truncated";
+        return false;
+    }
+    if (sample.empty()) return true;
+
+    // Spot check the sampled codes' records against what they generate.  The combined file is the
+    // non-decimal records followed by the decimal records, each sorted
+    const string ndec_prefix {"\n^" + job.site.ndec_global + "(\"Subscript 1\",\""};
+    const string dec_prefix {"\n^" + job.site.dec_global + "(\"Subscript 1\",\""};
+    size_t ndec_end = data.size(), dec_start = 0;
+    if (job.which == go_comb) {
+        dec_start = ndec_end = data.find(dec_prefix);
+        if (dec_start == string::npos) {
+            error = "no decimal records";
+            return false;
         }
-        zip_arch.close();
     }
+    string record;
+    for (const ICDCode &code : sample) {
+        for (const bool decimal : {false, true}) {
+            if (decimal ? job.which == go_ndec : job.which == go_dec) continue;
+            record.clear();
+            gen_go_records(record, &code, &code + 1, decimal, job.site);
+            const string &prefix = decimal ? dec_prefix : ndec_prefix;
+            const size_t pos = decimal ? find_record(data, dec_start, data.size(), prefix, code.dec_code) : find_record(data, 0, ndec_end, prefix, code.code);
+            if (pos == string::npos || data.compare(pos, record.size(), record) != 0) {
+                error = "record for " + (decimal ? code.dec_code : code.code) + " is missing or doesn't match";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool source_date_epoch(time_t &when) {
+    // Support function
+    const char *val = getenv("SOURCE_DATE_EPOCH");
+    if (!val || !*val) return false;
+    char *end = nullptr;
+    const long long secs = strtoll(val, &end, 10);
+    if (*end || secs < 0) return false;
+    when = static_cast<time_t>(secs);
+    return true;
+}
+
+size_t find_eocd(const string &data) {
+    // Support function
+    // The end of central directory record is the last thing in the file, followed only by its comment
+    if (data.size() < 22) return string::npos;
+    for (size_t pos = data.size() - 22;; pos--) {
+        if (get_le32(data, pos) == 0x06054b50) return pos;
+        if (pos == 0 || data.size() - pos > 22 + 0xffff) return string::npos;
+    }
+}
+
+void dos_datetime(time_t when, bool utc, uint16_t &dos_time, uint16_t &dos_date) {
+    // Support function
+    tm parts {};
+#ifdef _WIN32
+    if (utc) gmtime_s(&parts, &when);
+    else localtime_s(&parts, &when);
+#else
+    if (utc) gmtime_r(&when, &parts);
+    else localtime_r(&when, &parts);
+#endif
+    // DOS times can't go before 1980, so anything earlier is stamped 1980-01-01 00:00.  They only have two second resolution
+    dos_time = 0;
+    dos_date = 1 << 5 | 1;
+    if (parts.tm_year >= 80) {
+        dos_time = static_cast<uint16_t>(parts.tm_hour << 11 | parts.tm_min << 5 | parts.tm_sec / 2);
+        dos_date = static_cast<uint16_t>((parts.tm_year - 80) << 9 | (parts.tm_mon + 1) << 5 | parts.tm_mday);
+    }
+}
+
+bool deflate_member(const string &data, const string &name, ZipMember &member) {
+    // Support function
+    member.name = name;
+    member.crc = Crc32::update(0, data);
+    member.size = data.size();
+    return Codec::current().deflate(data.data(), data.size(), member.deflated, DEFLATE_LEVEL);
+}
+
+bool build_zip(const vector<ZipMember> &members, string &outp) {
+    // Support function
+    // Everything is already deflated, so the archive is laid out directly: each local header and its data, then the
+    // central directory, then the end of central directory.  No zip64, so everything has to fit in 32 bits
+    size_t total = 22;
+    for (const ZipMember &it : members) {
+        if (it.size >= 0xffffffff || it.deflated.size() >= 0xffffffff || it.name.size() > 0xffff) return false;
+        total += 30 + 46 + 2 * it.name.size() + it.deflated.size();
+    }
+    if (total >= 0xffffffff || members.size() >= 0xffff) return false;
+
+    // A fixed SOURCE_DATE_EPOCH is stamped in UTC, so the same data always gives the same bytes
+    time_t when;
+    const bool reproducible = source_date_epoch(when);
+    if (!reproducible) when = time(nullptr);
+    uint16_t dos_time, dos_date;
+    dos_datetime(when, reproducible, dos_time, dos_date);
+
+    // The fields from version needed through the name length are the same in both headers
+    const auto common = [&](const ZipMember &member) {
+        put_le(outp, 20, 2); // Version needed to extract: 2.0, for deflate
+        put_le(outp, 0, 2); // Flags
+        put_le(outp, 8, 2); // Method: deflate
+        put_le(outp, dos_time, 2);
+        put_le(outp, dos_date, 2);
+        put_le(outp, member.crc, 4);
+        put_le(outp, member.deflated.size(), 4);
+        put_le(outp, member.size, 4);
+        put_le(outp, member.name.size(), 2);
+    };
+
+    outp.clear();
+    outp.reserve(total);
+    vector<size_t> offsets;
+    offsets.reserve(members.size());
+    for (const ZipMember &it : members) {
+        offsets.push_back(outp.size());
+        put_le(outp, 0x04034b50, 4);
+        common(it);
+        put_le(outp, 0, 2); // Extra field length
+        outp.append(it.name).append(it.deflated);
+    }
+
+    const size_t central = outp.size();
+    for (size_t i = 0; i < members.size(); i++) {
+        put_le(outp, 0x02014b50, 4);
+        put_le(outp, 3 << 8 | 20, 2); // Made by: Unix, 2.0
+        common(members[i]);
+        put_le(outp, 0, 2); // Extra field length
+        put_le(outp, 0, 2); // Comment length
+        put_le(outp, 0, 2); // Disk number
+        put_le(outp, 0, 2); // Internal attributes
+        put_le(outp, 0100644u << 16, 4); // External attributes: a regular file, rw-r--r--
+        put_le(outp, offsets[i], 4);
+        outp.append(members[i].name);
+    }
+
+    const size_t central_size = outp.size() - central;
+    put_le(outp, 0x06054b50, 4);
+    put_le(outp, 0, 2); // This disk
+    put_le(outp, 0, 2); // Central directory disk
+    put_le(outp, members.size(), 2); // Entries on this disk
+    put_le(outp, members.size(), 2); // Entries
+    put_le(outp, central_size, 4);
+    put_le(outp, central, 4);
+    put_le(outp, 0, 2); // Comment length
+    return true;
+}
+
+bool compress_buffer(const string &data, const string &fil_name, string &outp) {
+    // Support function
+    vector<ZipMember> members(1);
+    return deflate_member(data, fil_name, members[0]) && build_zip(members, outp);
+}
+
+bool compress_entry(const string &data, const string &zip_name, const string &fil_name) {
+    // Support function
+    string archive;
+    if (!compress_buffer(data, fil_name, archive)) return false;
+    OutputWriter writer;
+    writer.add(zip_name, move(archive));
+    return writer.flush();
+}
+
+bool compress_data(const string &data, string &base_path, string fname, string ext, OutputWriter *writer) {
+    // Support function
+    if (!writer) return compress_entry(data, base_path + fname + ".zip", fname + ext);
+    string archive;
+    if (!compress_buffer(data, fname + ext, archive)) return false;
+    writer->add(base_path + fname + ".zip", move(archive));
+    return true;
 }
 
 bool load_zip_file(ProgramState &state, const ArgParser &parser, const filesystem::path &fspath) {
     // Support function
     state.zip_fname = move(fspath.filename().string());
-    if (!parser.found("year")) state.year = state.zip_fname.substr(0, 4);
+    // The CMS zip's name starts with its year, and a saved one that was rebuilt around the order file is named after it
+    if (!parser.found("year")) state.year = state.zip_fname.substr(state.zip_fname.starts_with(ORDER_BASE) ? sizeof(ORDER_BASE) - 1 : 0, 4);
     // Open a stream to the zip file for input in binary mode.  Seek to the end immediately after opening
     ifstream zip_fil(fspath, ios::binary | ios::in | ios::ate);
     if (!zip_fil) {
@@ -500,14 +1210,12 @@ bool load_zip_file(ProgramState &state, const ArgParser &parser, const filesyste
     streambuf *zip_buf = zip_fil.rdbuf();
     // Seek the buffer back to the beginning
     zip_buf->pubseekoff(0, ios::beg);
-    char *raw_data = new char[num_char];
-    // No need to shrink to fit later because we WILL be using all of this space
-    state.zip_file.reserve(num_char);
+    // Size the string once and read straight into it.  No intermediate buffer, so the file is only held in memory once
+    state.zip_file.resize(static_cast<size_t>(num_char));
     // Yes zip_fil is an ifstream but using stream-based input formats the inputs which is NOT desired when reading raw
     // data for a zip file.  Use sgetn on the buffer instead.  Use the character count fetched earlier to determine how
     // many characters to get.
-    zip_buf->sgetn(raw_data, num_char);
-    state.zip_file.assign(raw_data, num_char);
+    state.zip_file.resize(static_cast<size_t>(zip_buf->sgetn(state.zip_file.data(), num_char)));
     // zip_fil will be closed automatically by the destructor
     return true;
 }
@@ -527,11 +1235,8 @@ bool load_text_file(string &file, const filesystem::path &fspath) {
     streampos num_char = fil.tellg();
     streambuf *buf = fil.rdbuf();
     buf->pubseekoff(0, ios::beg);
-    char *raw_data = new char[num_char];
-    // No need to shrink to fit later because we WILL be using all of this space
-    file.reserve(num_char);
-    buf->sgetn(raw_data, num_char);
-    file.assign(raw_data, num_char);
+    file.resize(static_cast<size_t>(num_char));
+    file.resize(static_cast<size_t>(buf->sgetn(file.data(), num_char)));
     return true;
 }
 
@@ -592,6 +1297,174 @@ bool parse_url(string &base, string &url) {
     return false;
 }
 
+bool find_icd10_link(const string &page, string &href, string &text) {
+    // Support function
+
+    size_t menu_start, menu_end, li_start, li_end, item_start, item_end, text_start, text_end, href_start, href_end;
+
+    // The ICD-10 CM link will be in the first menu class unordered list
+    menu_start = page.find("<ul class=\"menu\">");
+    if (menu_start != string::npos) {
+        menu_end = page.find("</ul>", menu_start);
+        if (menu_end != string::npos && menu_end > menu_start) {
+            li_start = page.find("<li", menu_start);
+            if (li_start != string::npos && li_start <= menu_end) {
+                while (li_start != string::npos) {
+                    li_end = page.find("</li>", li_start);
+                    if (li_end == string::npos) break;
+
+                    item_start = page.find("<a href=\"", li_start);
+                    if (item_start == string::npos || item_start > li_end) break;
+
+                    item_end = page.find("</a>", item_start);
+                    if (item_end == string::npos || item_end > li_end) break;
+
+                    href_start = page.find('"', item_start);
+                    // Move href_start forward one to avoid capturing the first " character
+                    if (href_start == string::npos || ++href_start > item_end) break;
+
+                    href_end = page.find('"', href_start);
+                    if (href_end == string::npos || href_end > item_end) break;
+
+                    href = page.substr(href_start, href_end - href_start);
+
+                    text_start = page.find('>', item_start);
+                    // Move text_start forward one to avoid capturing the > character from the end of the <a> tag
+                    if (text_start == string::npos || ++text_start > item_end) break;
+
+                    text_end = page.find('<', text_start);
+                    if (text_end == string::npos || text_end > item_end) break;
+
+                    text = page.substr(text_start, text_end - text_start);
+                    if (text.find("icd-10") != string::npos && text.find("cm") != string::npos) {
+                        return true;
+                    }
+
+                    li_start = page.find("<li", li_end);
+                    if (li_start == string::npos || li_start > menu_end) break;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool find_tab_order_link(const string &page, string &href) {
+    // Support function
+
+    size_t text_loc, tag_start, tag_end;
+    text_loc = page.find("tabular order");
+    if (text_loc != string::npos) {
+        tag_end = page.rfind("\"", text_loc);
+        if (tag_end != string::npos && tag_end <= text_loc) {
+            // Move tag_end back by one to avoid finding the same " character
+            tag_start = page.rfind("\"", --tag_end);
+            // Move tag_start forward by one to avoid capturing the first " character
+            // End " is already dropped; move tag_end forward again to capture the last character from the link
+            if (tag_start != string::npos && ++tag_start <= tag_end++) {
+                href = page.substr(tag_start, tag_end - tag_start);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void scan_chunk(LinkScanner &scanner, const char *data, size_t length) {
+    // Support function
+    if (scanner.done) return;
+    const size_t old_size = scanner.window.size();
+    scanner.window.append(data, length);
+    for (size_t i = old_size; i < scanner.window.size(); i++) scanner.window[i] = tolower(scanner.window[i]);
+    scanner.bytes += length;
+
+    if (scanner.target == LinkScanner::icd10_link) {
+        // Only the first menu is looked in, so nothing before it is needed, and the link is settled once it's closed
+        const string menu {"<ul class=\"menu\">"};
+        const size_t menu_start = scanner.window.find(menu);
+        if (menu_start == string::npos) {
+            // Keep enough to match a menu tag split across chunks
+            if (scanner.window.size() >= menu.size()) scanner.window.erase(0, scanner.window.size() - menu.size() + 1);
+            return;
+        }
+        if (menu_start) scanner.window.erase(0, menu_start);
+        if (scanner.window.find("</ul>", menu.size()) == string::npos) return;
+        scanner.found = find_icd10_link(scanner.window, scanner.href, scanner.text);
+    } else {
+        // The link comes before its text, within the window kept behind the scan
+        if (scanner.window.find("tabular order") == string::npos) {
+            if (scanner.window.size() > SCAN_WINDOW) scanner.window.erase(0, scanner.window.size() - SCAN_WINDOW);
+            return;
+        }
+        scanner.found = find_tab_order_link(scanner.window, scanner.href);
+    }
+    scanner.done = true;
+}
+
+void gen_order_file(string &outp, const SynthOptions &opts) {
+    // Support function
+
+    // Medical-sounding filler.  The parser doesn't care what the words are, only where the columns are
+    constexpr const char *words[] = {"acute", "chronic", "infection", "of", "the", "upper", "lower", "left", "right", "bilateral",
+        "unspecified", "site", "with", "without", "complication", "fracture", "displaced", "nondisplaced", "initial", "encounter",
+        "subsequent", "sequela", "neoplasm", "malignant", "benign", "disorder", "syndrome", "injury", "joint", "muscle", "tendon",
+        "nerve", "vessel", "artery", "vein", "heart", "lung", "kidney", "liver", "skin", "bone"};
+    constexpr size_t num_words = sizeof(words) / sizeof(words[0]);
+    constexpr char base36[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    constexpr size_t short_len = 60; // Short descriptions are padded (or cut) to exactly 60 characters
+    // Spread the lines over every category from A00 to Z99.  The index within a category becomes a base 36 suffix, so the
+    // codes stay unique (and no longer than 7 characters) well past 100x
+    constexpr size_t num_cats = 26 * 100;
+
+    const size_t num_lines = max<size_t>(1, static_cast<size_t>(SYNTH_BASE_LINES * opts.scale));
+    const size_t per_cat = (num_lines + num_cats - 1) / num_cats;
+    const size_t min_desc = max<size_t>(1, opts.desc_len / 2), max_desc = max<size_t>(min_desc, opts.desc_len + opts.desc_len / 2);
+
+    mt19937 rng(opts.seed);
+    uniform_real_distribution<double> hipaa_dist(0.0, 1.0);
+    uniform_int_distribution<size_t> len_dist(min_desc, max_desc);
+    uniform_int_distribution<size_t> word_dist(0, num_words - 1);
+
+    outp.clear();
+    // Fixed columns are 77 characters, plus the long description and the line ending
+    outp.reserve(num_lines * (77 + opts.desc_len + opts.line_end.size()));
+    string code, desc;
+    code.reserve(8);
+    desc.reserve(max_desc + 16);
+    char order[6] = "";
+    for (size_t i = 0; i < num_lines; i++) {
+        size_t cat = i / per_cat, sub = i % per_cat;
+        code.assign(1, static_cast<char>('A' + cat / 100));
+        code.push_back(static_cast<char>('0' + cat % 100 / 10));
+        code.push_back(static_cast<char>('0' + cat % 10));
+        // Index 0 is the bare category; everything after it gets a suffix
+        size_t suffix_start = code.size();
+        for (; sub; sub /= 36) code.insert(code.begin() + suffix_start, base36[sub % 36]);
+
+        size_t target = len_dist(rng);
+        desc.clear();
+        while (desc.size() < target) {
+            if (!desc.empty()) desc.push_back(' ');
+            desc.append(words[word_dist(rng)]);
+        }
+        desc.resize(target);
+        // Real descriptions never end in a space (and parse_codes expects at least one character)
+        while (desc.size() > 1 && desc.back() == ' ') desc.pop_back();
+        desc[0] = static_cast<char>(toupper(desc[0]));
+
+        // The order number column is only 5 wide; wrap it rather than shift every column after it
+        snprintf(order, sizeof(order), "%05zu", (i + 1) % 100000);
+        outp.append(order, 5).push_back(' ');
+        outp.append(code).append(7 - code.size(), ' ').push_back(' ');
+        outp.push_back(hipaa_dist(rng) < opts.hipaa_ratio ? '1' : '0');
+        outp.push_back(' ');
+        outp.append(desc, 0, short_len);
+        if (desc.size() < short_len) outp.append(short_len - desc.size(), ' ');
+        outp.push_back(' ');
+        outp.append(desc).append(opts.line_end);
+    }
+}
+
 void parse_codes(const string &data, vector<ICDCode> &codes) {
     // Support function
 
@@ -655,15 +1528,17 @@ void parse_codes(const string &data, vector<ICDCode> &codes) {
 
     // In case our estimate was too big, return extra memory to the system
     codes.shrink_to_fit();
+}
+
+void sort_codes(vector<ICDCode> &codes) {
+    // Support function
 
     // Codes aren't necessarily in alpha order, so sort them
     // They're nearly sorted so timsort would be ideal (especially given the number of elements), but too painful to write for this small of a project
     sort(codes.begin(), codes.end(), comp_icdcode);
 }
 
-// Generate go file from codes into outp.  Read date information from year, timestamp, and dj
-// For bitmask, 1 = decimal file, 2 = append ending newlines, 4 = prepend header.  Combine using bitwise or.
-void gen_go_file(string *outp, vector<ICDCode> const *codes, string const *year, tm *timestamp, string *dj, char bitmask) {
+void gen_go_file(string *outp, vector<ICDCode> const *codes, string const *year, tm *timestamp, string *dj, char bitmask, const SiteVariant &site) {
     // Support function
     if (bitmask & 4) {
         char part1[15] = "", part2[3] = "", part3[15] = "";
@@ -682,140 +1557,270 @@ void gen_go_file(string *outp, vector<ICDCode> const *codes, string const *year,
          * META-COMMENT:                                                                                                  *
          * To protect potentially proprietary information, both the global name and the subscripts have been modified     *
          ******************************************************************************************************************/
-        if (!(bitmask & 1)) outp->append("NON");
-        outp->append("DECGBL");
+        outp->append(bitmask & 1 ? site.dec_global : site.ndec_global);
         outp->append("(\"Subscript 1\")\n").append(*dj).append("_PLACEHOLDER FOR YEAR ").append(*year).push_back('\n');
     }
-    for (const ICDCode &it : *codes) {
-        outp->push_back('^');
-        if (!(bitmask & 1)) outp->append("NON");
-        outp->append("DECGBL(\"Subscript 1\",\"").append((bitmask & 1) ? it.dec_code : it.code).append("\")\n");
-        outp->append(it.desc).push_back('\n');
-    }
+    gen_go_records(*outp, codes->data(), codes->data() + codes->size(), bitmask & 1, site);
     if (bitmask & 2) outp->append("\n\n");
 }
 
-void gen_files(const vector<ICDCode> &codes, const string &year, string &dec, string &ndec, string &comb) {
+void gen_go_records(string &outp, const ICDCode *first, const ICDCode *last, bool decimal, const SiteVariant &site) {
     // Support function
+    const string &global = decimal ? site.dec_global : site.ndec_global;
+    for (const ICDCode *it = first; it != last; it++) {
+        outp.push_back('^');
+        outp.append(global).append("(\"Subscript 1\",\"").append(decimal ? it->dec_code : it->code).append("\")\n");
+        outp.append(it->desc).push_back('\n');
+    }
+}
 
-    // Estimate roughly IND_CHARS_PER_LINE characters per code; reserve the ram to minimize reallocations
-    ndec.reserve(codes.size() * IND_CHARS_PER_LINE);
-    dec.reserve(codes.size() * IND_CHARS_PER_LINE);
-    // Estimate COMB_CHARS_PER_LINE per code for combined files (just over twice the size of the individual files)
-    comb.reserve(codes.size() * COMB_CHARS_PER_LINE);
-    // Use the same estimate for the second half of the combined file as for the decimal file
-    string *comb2 = new string;
-    comb2->reserve(codes.size() * IND_CHARS_PER_LINE);
+void gen_files(const vector<ICDCode> &codes, const string &year, string &dec, string &ndec, string &comb, Profiler *profiler, const GoFileReady &ready, const SiteVariant &site, Progress *progress) {
+    // Support function
 
     using namespace chrono;
-    const time_point<system_clock> now = system_clock::now();
-    const time_t time = system_clock::to_time_t(now);
-    tm *ltim = new tm();
-    localtime_s(ltim, &time);
+    // A fixed SOURCE_DATE_EPOCH is shown in UTC, so the output doesn't depend on the time zone it was built in either
+    time_t time;
+    const bool reproducible = source_date_epoch(time);
+    const time_point<system_clock> now = reproducible ? system_clock::from_time_t(time) : system_clock::now();
+    time = system_clock::to_time_t(now);
+    tm ltim {};
+#ifdef _WIN32
+    if (reproducible) gmtime_s(&ltim, &time);
+    else localtime_s(&ltim, &time);
+#else
+    if (reproducible) gmtime_r(&time, &ltim);
+    else localtime_r(&time, &ltim);
+#endif
     /******************************************************************************************************************
      * META-COMMENT:                                                                                                  *
      * To protect potentially proprietary information, the 0 date for internal julian date indexing has been modified *
      ******************************************************************************************************************/
     string dj = move(to_string(duration_cast<days>(now.time_since_epoch()).count() - 7182));
 
+    /*
+    * The combined file is the non-decimal file without its footer followed by the decimal file without its header, so
+    * only the non-decimal and decimal records are generated, once each, and the three files are assembled from them:
+    *     ndec = ndec header + ndec records + footer
+    *     dec  = dec header  + dec records  + footer
+    *     comb = ndec header + ndec records + dec records + footer
+    */
+    const vector<ICDCode> no_codes;
+    string ndec_header, dec_header;
+    // 4 = non-decimal, header only
+    gen_go_file(&ndec_header, &no_codes, &year, &ltim, &dj, 4, site);
+    // 5 = decimal, header only
+    gen_go_file(&dec_header, &no_codes, &year, &ltim, &dj, 5, site);
+
     /*Threads
-    * Yes, using threads can be dangerous.  But only ndec, dec, comb, and comb2 are being written to, and each of those
-    * in a separate thread.  All data used by multiple threads is only being read.
+    * The work is a task graph on the worker pool rather than a series of stages with a join between each:
+    *     ndec chunk i --> assemble ndec --> ready(ndec) --> release ndec chunks
+    *                  \-> assemble comb --> ready(comb) --/
+    *     dec chunk i  --> assemble dec  --> ready(dec)  --> release dec chunks
+    *                  \-> assemble comb
+    * Each chunk task writes only its own chunk and each assemble task only its own file, so nothing is shared that's
+    * written to.  Nodes are declared consumers first, since a node has to exist before anything can arrive on it
     */
-    // 6 = non-decimal, with header and footer
-    thread t1(gen_go_file, &ndec, &codes, &year, ltim, &dj, 6);
-    // 7 = decimal, with header and footer
-    thread t2(gen_go_file, &dec, &codes, &year, ltim, &dj, 7);
-    // 4 = non-decimal, with header but no footer
-    thread t3(gen_go_file, &comb, &codes, &year, ltim, &dj, 4);
-    // 3 = decimal, with footer but no header
-    thread t4(gen_go_file, comb2, &codes, &year, ltim, &dj, 3);
-    t1.join();
-    t2.join();
-    t3.join();
-    t4.join();
-    comb.append(move(*comb2));
-    
-    // Now that they're built, return the extra ram in case the estimates were too big
-    ndec.shrink_to_fit();
-    dec.shrink_to_fit();
-    comb.shrink_to_fit();
+    ThreadPool &pool = ThreadPool::instance();
+    const size_t num_chunks = (codes.size() + GEN_CHUNK_CODES - 1) / GEN_CHUNK_CODES;
+    vector<string> ndec_chunks(num_chunks), dec_chunks(num_chunks);
+    const auto assemble = [](string &outp, const string &header, initializer_list<const vector<string> *> parts) {
+        size_t len = header.size() + 2;
+        for (const vector<string> *part : parts) {
+            for (const string &it : *part) len += it.size();
+        }
+        // Now the size is known exactly, so the file is allocated once at its final size
+        outp.clear();
+        outp.reserve(len);
+        outp.append(header);
+        for (const vector<string> *part : parts) {
+            for (const string &it : *part) outp.append(it);
+        }
+        outp.append("\n\n");
+    };
+
+    ThreadPool::Group group;
+    // Each set of chunks is used by its own file and the combined file; give the memory back once both have it
+    ThreadPool::Node ndec_release(pool, group, 2, [&] { vector<string>().swap(ndec_chunks); });
+    ThreadPool::Node dec_release(pool, group, 2, [&] { vector<string>().swap(dec_chunks); });
+    ThreadPool::Node ndec_assemble(pool, group, num_chunks, [&] {
+        {
+            TraceSpan span(profiler, "assemble ndec");
+            assemble(ndec, ndec_header, {&ndec_chunks});
+        }
+        ndec_release.arrive();
+        if (ready) ready(go_ndec, ndec);
+    });
+    ThreadPool::Node dec_assemble(pool, group, num_chunks, [&] {
+        {
+            TraceSpan span(profiler, "assemble dec");
+            assemble(dec, dec_header, {&dec_chunks});
+        }
+        dec_release.arrive();
+        if (ready) ready(go_dec, dec);
+    });
+    ThreadPool::Node comb_assemble(pool, group, 2 * num_chunks, [&] {
+        {
+            TraceSpan span(profiler, "assemble comb");
+            assemble(comb, ndec_header, {&ndec_chunks, &dec_chunks});
+        }
+        ndec_release.arrive();
+        dec_release.arrive();
+        if (ready) ready(go_comb, comb);
+    });
+    for (size_t i = 0; i < num_chunks; i++) {
+        const ICDCode *first = codes.data() + i * GEN_CHUNK_CODES;
+        const ICDCode *last = codes.data() + min(codes.size(), (i + 1) * GEN_CHUNK_CODES);
+        pool.submit(group, [&, first, last, i] {
+            {
+                TraceSpan span(profiler, "gen ndec records");
+                // Estimate roughly IND_CHARS_PER_LINE characters per code; reserve the ram to minimize reallocations
+                ndec_chunks[i].reserve((last - first) * IND_CHARS_PER_LINE);
+                gen_go_records(ndec_chunks[i], first, last, false, site);
+            }
+            if (progress) progress->add(Progress::records, last - first);
+            ndec_assemble.arrive();
+            comb_assemble.arrive();
+        });
+        pool.submit(group, [&, first, last, i] {
+            {
+                TraceSpan span(profiler, "gen dec records");
+                dec_chunks[i].reserve((last - first) * IND_CHARS_PER_LINE);
+                gen_go_records(dec_chunks[i], first, last, true, site);
+            }
+            if (progress) progress->add(Progress::records, last - first);
+            dec_assemble.arrive();
+            comb_assemble.arrive();
+        });
+    }
+    pool.wait(group);
+}
+
+bool parse_request(const string &line, string &command, vector<pair<string, string>> &args) {
+    // Support function
+    command.clear();
+    args.clear();
+    size_t pos = 0;
+    while (true) {
+        while (pos < line.size() && isspace(static_cast<unsigned char>(line[pos]))) pos++;
+        if (pos >= line.size()) break;
+        // Each token is a bare word or key=value, and either part may be quoted so paths can hold spaces
+        string token;
+        size_t equals = string::npos;
+        while (pos < line.size() && !isspace(static_cast<unsigned char>(line[pos]))) {
+            if (line[pos] == '"') {
+                size_t close = line.find('"', pos + 1);
+                if (close == string::npos) return false;
+                token.append(line, pos + 1, close - pos - 1);
+                pos = close + 1;
+            } else {
+                if (line[pos] == '=' && equals == string::npos) equals = token.size();
+                token.push_back(line[pos++]);
+            }
+        }
+        if (command.empty()) {
+            if (equals != string::npos) return false;
+            command = move(token);
+            to_lower(command);
+        } else {
+            if (equals == string::npos) return false;
+            string key = token.substr(0, equals);
+            to_lower(key);
+            args.emplace_back(move(key), token.substr(equals + 1));
+        }
+    }
+    return !command.empty();
+}
+
+bool valid_global(const string &name) {
+    // Support function
+    // Global names are a letter or % followed by letters and digits
+    if (name.empty() || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '%')) return false;
+    return all_of(name.begin() + 1, name.end(), [](char c) { return isalnum(static_cast<unsigned char>(c)) != 0; });
+}
+
+bool parse_sites(const string &data, vector<SiteVariant> &sites, string &error) {
+    // Support function
+    sites.clear();
+    istringstream lines(data);
+    string line, command;
+    vector<pair<string, string>> args;
+    for (size_t line_num = 1; getline(lines, line); line_num++) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#') continue;
+        const string where = "line " + to_string(line_num) + ": ";
+        if (!parse_request(line, command, args) || command != "site") {
+            error = where + "expected \"site name=Name ...\"";
+            return false;
+        }
+        SiteVariant site;
+        for (pair<string, string> &it : args) {
+            if (it.first == "name") {
+                site.name = move(it.second);
+            } else if (it.first == "path") {
+                site.dest_path = move(it.second);
+                if (site.dest_path.empty() || !filesystem::is_directory(site.dest_path)) {
+                    error = where + "\"" + site.dest_path + "\" is not a directory";
+                    return false;
+                }
+                if (site.dest_path.back() != filesystem::path::preferred_separator) site.dest_path.push_back(filesystem::path::preferred_separator);
+            } else if (it.first == "dec-global" || it.first == "ndec-global") {
+                if (!valid_global(it.second)) {
+                    error = where + "\"" + it.second + "\" is not a valid global name";
+                    return false;
+                }
+                (it.first == "dec-global" ? site.dec_global : site.ndec_global) = move(it.second);
+                if (site.dec_global == site.ndec_global) {
+                    error = where + "dec-global and ndec-global must differ";
+                    return false;
+                }
+            } else if (it.first == "prefix") {
+                site.fname_prefix = move(it.second);
+            } else {
+                error = where + "unknown key \"" + it.first + "\"";
+                return false;
+            }
+        }
+        if (site.name.empty()) {
+            error = where + "site has no name";
+            return false;
+        }
+        sites.push_back(move(site));
+    }
+    if (sites.empty()) {
+        error = "no sites";
+        return false;
+    }
+    return true;
 }
 
 /****************************************************************************************************************
 * Main functions
 ****************************************************************************************************************/
-// Get the latest ICD-10 page link from the cms.gov website
 bool get_newest_icd10_link(ProgramState &state) {
     // Main function
+    if (!start_network(state)) return false;
 
+    ProfileStage stage(state.profiler, "discovery");
     string cms_url {state.cms_base};
     cms_url.append(move(state.cms_url));
 
-    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &state.working_data);
-    curl_easy_setopt(state.easyhandle, CURLOPT_URL, cms_url.c_str());
-    if (state.disp) cout << "Fetching CMS website..." << endl;
-    const CURLcode res = curl_easy_perform(state.easyhandle);
+    LinkScanner scanner {LinkScanner::icd10_link};
+    show_status(state, "Fetching CMS website...");
+    const CURLcode res = scan_page(state, cms_url, scanner);
     if (res != CURLE_OK) {
         cerr << "Easy perform failed to get CMS website: " << curl_easy_strerror(res) << endl;
         state.outp = OutputCode::cms_get_failed;
         return false;
     }
 
-    if (state.disp) cout << "Locating latest ICD-10 CM link..." << endl;
-
-    size_t menu_start, menu_end, li_start, li_end, item_start, item_end, text_start, text_end, href_start, href_end;
-    string href, item_text;
-    to_lower(state.working_data);
-
-    // The ICD-10 CM link will be in the first menu class unordered list
-    menu_start = state.working_data.find("<ul class=\"menu\">");
-    if (menu_start != string::npos) {
-        menu_end = state.working_data.find("</ul>", menu_start);
-        if (menu_end != string::npos && menu_end > menu_start) {
-            li_start = state.working_data.find("<li", menu_start);
-            if (li_start != string::npos && li_start <= menu_end) {
-                while (li_start != string::npos) {
-                    li_end = state.working_data.find("</li>", li_start);
-                    if (li_end == string::npos) break;
-
-                    item_start = state.working_data.find("<a href=\"", li_start);
-                    if (item_start == string::npos || item_start > li_end) break;
-
-                    item_end = state.working_data.find("</a>", item_start);
-                    if (item_end == string::npos || item_end > li_end) break;
-
-                    href_start = state.working_data.find('"', item_start);
-                    // Move href_start forward one to avoid capturing the first " character
-                    if (href_start == string::npos || ++href_start > item_end) break;
+    show_status(state, "Locating latest ICD-10 CM link...");
 
-                    href_end = state.working_data.find('"', href_start);
-                    if (href_end == string::npos || href_end > item_end) break;
-
-                    href = state.working_data.substr(href_start, href_end - href_start);
-
-                    text_start = state.working_data.find('>', item_start);
-                    // Move text_start forward one to avoid capturing the > character from the end of the <a> tag
-                    if (text_start == string::npos || ++text_start > item_end) break;
-
-                    text_end = state.working_data.find('<', text_start);
-                    if (text_end == string::npos || text_end > item_end) break;
-
-                    item_text = state.working_data.substr(text_start, text_end - text_start);
-                    if (item_text.find("icd-10") != string::npos && item_text.find("cm") != string::npos) {
-                        state.icd10_url = move(href);
-                        if (state.year.empty()) state.year = move(item_text.substr(0, 4));
-                        break;
-                    }
-
-                    li_start = state.working_data.find("<li", li_end);
-                    if (li_start == string::npos || li_start > menu_end) break;
-                }
-            }
-        }
+    stage.bytes(scanner.wire_bytes, scanner.bytes);
+    if (scanner.found) {
+        state.icd10_url = move(scanner.href);
+        if (state.year.empty()) state.year = scanner.text.substr(0, 4);
     }
 
-
     if (state.icd10_url.empty()) {
         cerr << "Could not parse latest ICD-10 url from CMS webpage!" << endl;
         state.outp = OutputCode::icd10_find_failed;
@@ -824,46 +1829,32 @@ bool get_newest_icd10_link(ProgramState &state) {
     string base_url {state.icd10_url}, icd10_url_copy {};
     // If the found URL can't be parsed, prepend with the cms.gov base URL
     if (!parse_url(base_url, icd10_url_copy)) state.icd10_url = state.cms_base + state.icd10_url;
-    state.working_data.clear();
 
-    if (state.disp) cout << "Found link for " << state.year << " ICD-10 codes: " << state.icd10_url << endl;
+    show_status(state, "Found link for " + state.year + " ICD-10 codes: " + state.icd10_url);
     return true;
 }
 
-// Get the link to the tabular order zip file from the latest ICD-10 CM page
 bool get_tab_order_zip_link(ProgramState &state) {
     // Main function
+    if (!start_network(state)) return false;
     if (state.icd10_url.empty()) {
         if (!get_newest_icd10_link(state)) return false;
     }
-    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &state.working_data);
-    curl_easy_setopt(state.easyhandle, CURLOPT_URL, state.icd10_url.c_str());
+    ProfileStage stage(state.profiler, "discovery");
+    LinkScanner scanner {LinkScanner::tab_order_link};
 
-    if (state.disp) cout << "Fetching latest ICD-10 CM page..." << endl;
-    const CURLcode res = curl_easy_perform(state.easyhandle);
+    show_status(state, "Fetching latest ICD-10 CM page...");
+    const CURLcode res = scan_page(state, state.icd10_url, scanner);
     if (res != CURLE_OK) {
         cerr << "Easy perform failed to get latest ICD-10 page: " << curl_easy_strerror(res) << endl;
         state.outp = OutputCode::icd10_get_failed;
         return false;
     }
 
-    if (state.disp) cout << "Locating link for tabular order codes..." << endl;
+    show_status(state, "Locating link for tabular order codes...");
 
-    size_t text_loc, tag_start, tag_end;
-    to_lower(state.working_data);
-    text_loc = state.working_data.find("tabular order");
-    if (text_loc != string::npos) {
-        tag_end = state.working_data.rfind("\"", text_loc);
-        if (tag_end != string::npos && tag_end <= text_loc) {
-            // Move tag_end back by one to avoid finding the same " character
-            tag_start = state.working_data.rfind("\"", --tag_end);
-            // Move tag_start forward by one to avoid capturing the first " character
-            // End " is already dropped; move tag_end forward again to capture the last character from the link
-            if (tag_start != string::npos && ++tag_start <= tag_end++) {
-                state.zip_url = state.working_data.substr(tag_start, tag_end - tag_start);
-            }
-        }
-    }
+    stage.bytes(scanner.wire_bytes, scanner.bytes);
+    if (scanner.found) state.zip_url = move(scanner.href);
 
     if (state.zip_url.empty()) {
         cerr << "Could not locate link for tabular order zip file!" << endl;
@@ -874,92 +1865,274 @@ bool get_tab_order_zip_link(ProgramState &state) {
     string base_url {state.zip_url}, zip_url_copy {};
     // If the found URL can't be parsed, prepend with the cms.gov base URL
     if (!parse_url(base_url, zip_url_copy)) state.zip_url = state.cms_base + state.zip_url;
-    state.working_data.clear();
     return true;
 }
 
-// Download the zip file from the tabular order zip file link
-bool get_zip_file(ProgramState &state) {
+bool find_zip_link(ProgramState &state) {
     // Main function
-    if (state.zip_url.empty()) {
-        if (!get_tab_order_zip_link(state)) return false;
+    if (!start_network(state)) return false;
+    // A page given with /i is for a particular release, so there's nothing to predict
+    if (!state.icd10_url.empty()) return get_tab_order_zip_link(state);
+
+    // The newest release is next year's once it's out, and this year's until then
+    const int this_year = static_cast<int>(chrono::year_month_day {chrono::floor<chrono::days>(chrono::system_clock::now())}.year());
+    const vector<string> years {to_string(this_year + 1), to_string(this_year)};
+    const bool year_given = !state.year.empty();
+    vector<string> urls, entries;
+    vector<CURL *> handles;
+    for (const string &it : years) {
+        CURL *easy = curl_easy_init();
+        if (!easy) break;
+        curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 1L);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, receive_data);
+        handles.push_back(easy);
+        urls.push_back(state.cms_base + ZIP_PATH + it + ZIP_BASE + ".zip");
+        entries.push_back(ORDER_BASE + (year_given ? state.year : it) + ".txt");
+    }
+    const auto cleanup = [&] { for (CURL *it : handles) curl_easy_cleanup(it); };
+    if (handles.size() != years.size()) {
+        cleanup();
+        return get_tab_order_zip_link(state);
     }
 
-    // Estimate ZIP_FILE_SIZE for the zip file
-    state.zip_file.reserve(ZIP_FILE_SIZE);
-
-    curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &(state.zip_file));
-    curl_easy_setopt(state.easyhandle, CURLOPT_URL, state.zip_url.c_str());
-
-    if (state.disp) cout << "Fetching tabular order zip file..." << endl;
-    const CURLcode res = curl_easy_perform(state.easyhandle);
-    if (res != CURLE_OK) {
-        cerr << "Easy perform failed to retrieve zip file: " << curl_easy_strerror(res) << endl;
-        state.outp = OutputCode::zip_find_failed;
-        return false;
+    // The probes run on the loop alongside the scrape's own transfers, and a hit starts downloading the predicted zip
+    // straight away.  The scrape always finishes, though, and the link the page lists is the one that's used: an off-cycle
+    // release can be under another name while the predicted zip still exists
+    size_t hit = string::npos;
+    bool stop = false;
+    string listed, predicted_zip;
+    bool rebuilt = false;
+    Async<bool> predicted = fetch_predicted_zip(*state.loop, handles, urls, entries, state.full_zip, stop, listed, hit, predicted_zip, rebuilt);
+    predicted.start();
+    const bool scraped = get_tab_order_zip_link(state);
+    if (scraped) {
+        listed = state.zip_url;
+        // Anything but the listed zip is abandoned, and get_zip_file downloads that instead.  stop catches the transfers
+        // that haven't started yet
+        if (hit != string::npos ? urls[hit] != listed : find(urls.begin(), urls.end(), listed) == urls.end()) {
+            stop = true;
+            for (CURL *it : handles) state.loop->cancel(it);
+        }
     }
+    // A scrape that failed leaves the probes to find the zip on their own
+    const bool downloaded = state.loop->run(predicted);
+    cleanup();
+    // A download of another zip may have finished before the page was read; it's thrown away just the same
+    if (!downloaded || (scraped && urls[hit] != listed)) return scraped;
+
+    // Already downloaded, so get_zip_file only has to save it
+    state.zip_file = move(predicted_zip);
+    state.zip_rebuilt = rebuilt;
+    state.outp = OutputCode::ok;
+    state.zip_url = urls[hit];
+    if (!year_given) state.year = years[hit];
+    if (scraped) show_status(state, "Downloaded the tabular order zip file while the CMS website was read: " + state.zip_url);
+    else show_status(state, "Found " + years[hit] + " tabular order zip file at its predicted link: " + state.zip_url);
+    return true;
+}
 
-    // Return the extra space if the estimate was too big
-    state.zip_file.shrink_to_fit();
+bool get_zip_file(ProgramState &state) {
+    // Main function
+    if (!start_network(state)) return false;
+    if (state.zip_url.empty()) {
+        if (!find_zip_link(state)) return false;
+    }
 
     string zip_fname = state.zip_url.substr(state.zip_url.rfind("/") + 1);
     if (state.year.empty()) state.year = zip_fname.substr(0, 4);
 
-    zip_fname = state.dest_path + zip_fname;
-    if (state.disp) cout << "Saving zip file..." << endl;
-    ofstream zip_file(zip_fname, ios::binary | ios::out | ios::trunc);
-    zip_file << state.zip_file;
-    zip_file.close();
+    // find_zip_link may have downloaded it already, from its predicted link
+    if (state.zip_file.empty()) {
+        ProfileStage stage(state.profiler, "download");
+        show_status(state, "Fetching tabular order zip file...");
+        if (state.progress) {
+            curl_easy_setopt(state.easyhandle, CURLOPT_XFERINFOFUNCTION, download_progress);
+            curl_easy_setopt(state.easyhandle, CURLOPT_XFERINFODATA, state.progress);
+            curl_easy_setopt(state.easyhandle, CURLOPT_NOPROGRESS, 0L);
+        }
+        const bool stop = false;
+        CURLcode res;
+        {
+            TraceSpan span(state.profiler, "curl perform");
+            res = state.loop->run(download_zip(*state.loop, state.easyhandle, state.zip_url, ORDER_BASE + state.year + ".txt", state.full_zip, stop, state.zip_file, state.zip_rebuilt));
+        }
+        // The write target was state.zip_file; put it back to the scratch string for everything else on the handle
+        curl_easy_setopt(state.easyhandle, CURLOPT_WRITEDATA, &state.working_data);
+        if (state.progress) curl_easy_setopt(state.easyhandle, CURLOPT_NOPROGRESS, 1L);
+        if (res != CURLE_OK) {
+            cerr << "Easy perform failed to retrieve zip file: " << curl_easy_strerror(res) << endl;
+            state.outp = OutputCode::zip_find_failed;
+            return false;
+        }
+        stage.bytes(0, state.zip_file.size());
+    }
+
+    // Saved by get_codes_file, in the background while the rest of the pipeline runs.  A zip rebuilt around the order file
+    // holds something else than the CMS zip does, so it isn't saved under that zip's name
+    state.zip_save_path = state.dest_path + (state.zip_rebuilt ? ORDER_BASE + state.year + ".zip" : zip_fname);
     return true;
 }
 
-// Extract the order codes file from the tabular order zip file
 bool get_codes_file(ProgramState &state) {
     // Main function
     if (state.zip_file.empty()) {
         if (!get_zip_file(state)) return false;
     }
 
-    // Estimate ORDER_FILE_SIZE for the extracted order codes file
-    state.order_file.reserve(ORDER_FILE_SIZE);
+    // This stage consumes the raw zip.  If it was downloaded, it's handed to a save on the worker pool, which owns it from
+    // here on; extraction only reads it, and it and the rest of the pipeline carry on while the save runs, until work
+    // joins it at the end and publishes it only if the run succeeded.  Otherwise it's freed on return, before parsing starts
+    finish_zip_save(state);
+    string local;
+    const string *zip_data = &local;
+    if (!state.zip_save_path.empty()) {
+        state.zip_save = make_shared<BackgroundSave>();
+        state.zip_save->path = move(state.zip_save_path);
+        state.zip_save->data = move(state.zip_file);
+        state.zip_save->task.emplace(stage_file_async(*state.loop, state.zip_save->writer, state.zip_save->path, state.zip_save->data, state.profiler));
+        show_status(state, "Saving zip file...");
+        state.zip_save->task->start();
+        zip_data = &state.zip_save->data;
+    } else {
+        local = move(state.zip_file);
+    }
+    state.zip_file.clear();
+    state.zip_rebuilt = false;
+    state.zip_save_path.clear();
+
+    bool extracted = false;
+    {
+        ProfileStage stage(state.profiler, "inflate");
+        // Estimate ORDER_FILE_SIZE for the extracted order codes file
+        state.order_file.reserve(ORDER_FILE_SIZE);
+
+        string order_fname = ORDER_BASE + state.year + ".txt";
+        show_status(state, "Extracting " + order_fname + " from zip file...");
+        extracted = uncompress_data(*zip_data, order_fname, state.order_file);
+
+        // Return the extra ram if the estimate was too big
+        state.order_file.shrink_to_fit();
+        stage.bytes(zip_data->size(), state.order_file.size());
+    }
 
-    string order_fname = ORDER_BASE + state.year + ".txt";
-    if (state.disp) cout << "Extracting " << order_fname << " from zip file..." << endl;
-    if (!uncompress_data(state.zip_file, order_fname, state.order_file)) {
+    if (!extracted) {
         cerr << "Unable to extract order codes file from zip!" << endl;
         state.outp = OutputCode::extract_file_failed;
         return false;
     }
 
-    // Return the extra ram if the estimate was too big
-    state.order_file.shrink_to_fit();
+    return true;
+}
 
+bool generate_go_files(ProgramState & state, const SiteFileReady &ready) {
+    // Main function
+    // A warm code set (from an earlier request in daemon mode) skips straight to generating
+    shared_ptr<const vector<ICDCode>> codes {state.codes};
+    if (!codes) {
+        if (state.order_file.empty()) {
+            if (!get_codes_file(state)) return false;
+        }
+        show_status(state, "Parsing ICD-10 codes and descriptions...");
+        vector<ICDCode> parsed;
+        {
+            ProfileStage stage(state.profiler, "parse");
+            // This stage consumes the order file; release it as soon as the codes have been pulled out of it
+            const string order_data {move(state.order_file)};
+            state.order_file.clear();
+            parse_codes(order_data, parsed);
+            stage.bytes(order_data.size(), 0);
+        }
+        {
+            ProfileStage stage(state.profiler, "sort");
+            sort_codes(parsed);
+        }
+        codes = make_shared<const vector<ICDCode>>(move(parsed));
+        if (state.keep_codes) state.codes = codes;
+    }
+
+    // The spot checks only need a few hundred codes, so they're copied out now and the full set is still freed as soon as
+    // it's generated
+    state.verify_sample.clear();
+    if (state.verify && !codes->empty()) {
+        mt19937_64 rng {random_device {}()};
+        uniform_int_distribution<size_t> pick(0, codes->size() - 1);
+        state.verify_sample.reserve(VERIFY_SAMPLES);
+        for (size_t i = 0; i < VERIFY_SAMPLES; i++) state.verify_sample.push_back((*codes)[pick(rng)]);
+    }
+
+    ProfileStage stage(state.profiler, "generate");
+    // ready may take the buffers, so count them on the way past
+    atomic<uint64_t> bytes_out {0};
+    // Every site only reads the same code set, so each site's files are generated by a task of their own on the worker
+    // pool, all at once, and each file is handed to ready the moment it's done while the rest are still being generated
+    const vector<SiteVariant> default_sites(1);
+    const vector<SiteVariant> &sites = state.sites.empty() ? default_sites : state.sites;
+    vector<array<string, 3>> files(sites.size()); // By site, then by GoFile
+    ThreadPool &pool = ThreadPool::instance();
+    ThreadPool::Group group;
+    for (size_t i = 0; i < sites.size(); i++) {
+        if (sites[i].name.empty()) show_status(state, "Generating global output files...");
+        else show_status(state, "Generating global output files for " + sites[i].name + "...");
+        pool.submit(group, [&, i] {
+            TraceSpan span(state.profiler, "generate site");
+            gen_files(*codes, state.year, files[i][go_dec], files[i][go_ndec], files[i][go_comb], state.profiler, [&, i](GoFile which, string &data) {
+                bytes_out.fetch_add(data.size(), memory_order_relaxed);
+                if (ready) ready(sites[i], which, data);
+            }, sites[i], state.progress);
+        });
+    }
+    pool.wait(group);
+    stage.bytes(0, bytes_out.load());
+    // Whatever ready didn't take is left in state; the last site's, if there's more than one
+    state.ndec_codes = move(files.back()[go_ndec]);
+    state.dec_codes = move(files.back()[go_dec]);
+    state.comb_codes = move(files.back()[go_comb]);
+    // Unless it's being kept warm, codes is only held here, so it's freed on return, before compression finishes
     return true;
 }
 
-// Generate .go files for decimal, non-decimal, and combined codes
-bool generate_go_files(ProgramState & state) {
+bool generate_order_file(ProgramState &state, const SynthOptions &opts) {
     // Main function
-    if (state.order_file.empty()) {
-        if (!get_codes_file(state)) return false;
+    if (state.year.empty()) state.year = SYNTH_YEAR;
+
+    if (state.disp) {
+        ostringstream msg;
+        msg << "Generating synthetic order file (" << opts.scale << "x)...";
+        show_status(state, msg.str());
     }
-    if (state.disp) cout << "Parsing ICD-10 codes and descriptions..." << endl;
-    vector<ICDCode> codes;
-    parse_codes(state.order_file, codes);
+    gen_order_file(state.order_file, opts);
 
-    if (state.disp) cout << "Generating global output files..." << endl;
-    gen_files(codes, state.year, state.dec_codes, state.ndec_codes, state.comb_codes);
+    string order_fname = ORDER_BASE + state.year + ".txt";
+    show_status(state, "Saving " + order_fname + "...");
+    // Binary mode so the requested line endings are written as-is
+    ofstream order_fil(state.dest_path + order_fname, ios::binary | ios::out | ios::trunc);
+    if (!order_fil) {
+        cerr << "Could not write " << state.dest_path << order_fname << "!" << endl;
+        state.outp = OutputCode::generate_failed;
+        return false;
+    }
+    order_fil << state.order_file;
+    order_fil.close();
+
+    string zip_fname = state.year + ZIP_BASE + ".zip";
+    show_status(state, "Compressing " + zip_fname + "...");
+    if (!compress_entry(state.order_file, state.dest_path + zip_fname, order_fname)) {
+        cerr << "Could not write " << state.dest_path << zip_fname << "!" << endl;
+        state.outp = OutputCode::generate_failed;
+        return false;
+    }
     return true;
 }
 
-// Main work function, compress the generated .go files to disk
 bool work(ProgramState &state) {
     // Main function
-    if (state.dec_codes.empty() || state.ndec_codes.empty() || state.comb_codes.empty()) {
-        if (!generate_go_files(state)) return false;
-    }
+    if (state.progress) state.progress->reset();
+    // The downloaded zip may still be saving in the background when this returns, however it returns, so it's joined here
+    struct SaveJoin {
+        ProgramState &state;
+        ~SaveJoin() { finish_zip_save(state); }
+    } save_join {state};
 
-    if (state.disp) cout << "Compressing files..." << endl;
     // compress_data2 is an attempt to speed up the runtime (probably slightly) by passing a pre-allocated buffer instead of letting libzippp take care of it
     // It's not working at this time.
     /*
@@ -974,16 +2147,451 @@ bool work(ProgramState &state) {
      * To protect potentially proprietary information, filenames have been modified such that they don't match        *
      * business-specific filenames                                                                                    *
      ******************************************************************************************************************/
+    static const char *const fname_bases[] = {"Non-decimal version - Filename_Base_", "Decimal version - Filename_Base_", "Combined version - Filename_Base_"};
+    static const char *const span_names[] = {"compress ndec", "compress dec", "compress comb"};
+
+    // Every archive (and .go file, with --write-go) is collected here as it's compressed and written in one batch at the
+    // end
+    OutputWriter writer(state.direct_io);
+    atomic<bool> compressed {true};
+    // Every archive that's written, for verifying afterwards
+    vector<VerifyJob> jobs;
+    mutex jobs_lock;
 
     /*Threads
-    * Again, threads can be dangerous, but again each file being written to is being touched by it's own thread
+    * Again, threads can be dangerous, but again each file being written to is being touched by it's own task
+    * Each file is compressed as soon as it's been generated, while the others are still being generated, and its
+    * buffer is moved into its task, so it's released as soon as that file has been compressed
     */
-    thread t1(compress_data, ref(state.ndec_codes), ref(state.dest_path), "Non-decimal version - Filename_Base_" + state.year, ".go");
-    thread t2(compress_data, ref(state.dec_codes), ref(state.dest_path), "Decimal version - Filename_Base_" + state.year, ".go");
-    thread t3(compress_data, ref(state.comb_codes), ref(state.dest_path), "Combined version - Filename_Base_" + state.year, ".go");
-    t1.join();
-    t2.join();
-    t3.join();
+    ThreadPool &pool = ThreadPool::instance();
+    ThreadPool::Group group;
+    atomic<uint64_t> bytes_in {0};
+
+    // Unless each file is deflated on its own, a site's entries are collected here as they're deflated, and laid out into
+    // archives once they all are.  The combined file is the non-decimal file without its footer followed by the decimal
+    // records, so when all three files come straight from generation and the codec can deflate fragments, those are
+    // deflated once each and spliced into every entry that holds them, and the combined file is never deflated itself.
+    // Separate and single archives alike are spliced whenever they can be
+    const bool loaded = !(state.dec_codes.empty() || state.ndec_codes.empty() || state.comb_codes.empty());
+    const ArchiveMode mode = state.archive_mode;
+    const bool splice = !loaded && state.go_files == 7 && Codec::current().can_deflate_parts();
+    struct SiteArchive {
+        ZipMember members[3]; // By GoFile.  Only the ones with a name are written
+        string zip_paths[3]; // Where each one is written.  The same for all of them, unless the archives are separate
+        // Spliced only.  The non-decimal file without its footer, and the decimal file's header and records.  The combined
+        // file is the first and the last of these
+        string ndec_part, dec_header_part, dec_records_part;
+    };
+    map<string, SiteArchive> archives; // By destination and file name prefix
+    const auto compress = [&](const SiteVariant &site, GoFile which, string &data) {
+        // Only the files that were asked for; the rest are dropped here
+        if (!(state.go_files & (1 << which))) {
+            string().swap(data);
+            return;
+        }
+        bytes_in.fetch_add(data.size(), memory_order_relaxed);
+        string dest_path {site.dest_path.empty() ? state.dest_path : site.dest_path};
+        string fname {site.fname_prefix + fname_bases[which] + state.year};
+        if (mode == archive_separate && !splice) {
+            {
+                lock_guard<mutex> lock(jobs_lock);
+                jobs.push_back({dest_path + fname + ".zip", fname + ".go", site, which, 1, data.substr(data.size() - min(data.size(), VERIFY_TAIL))});
+            }
+            pool.submit(group, [&, which, data = move(data), dest_path = move(dest_path), fname = move(fname)]() mutable {
+                TraceSpan span(state.profiler, span_names[which]);
+                if (!compress_data(data, dest_path, fname, ".go", &writer)) compressed.store(false);
+                if (state.progress) state.progress->add(Progress::compressed, data.size());
+                if (state.write_go) writer.add(dest_path + fname + ".go", move(data));
+            });
+            return;
+        }
 
+        // Entries are claimed here, so two sites sharing a destination and prefix are caught rather than racing
+        SiteArchive *archive;
+        {
+            lock_guard<mutex> lock(jobs_lock);
+            const string zip_path {dest_path + (mode == archive_separate ? fname : site.fname_prefix + ARCHIVE_BASE + state.year) + ".zip"};
+            archive = &archives[dest_path + site.fname_prefix];
+            if (!archive->members[which].name.empty()) {
+                cerr << "\"" << fname << ".go\" is generated more than once for \"" << dest_path << "\"!" << endl;
+                compressed.store(false);
+                string().swap(data);
+                return;
+            }
+            archive->members[which].name = fname + ".go";
+            archive->zip_paths[which] = zip_path;
+            jobs.push_back({zip_path, fname + ".go", site, which, 1, data.substr(data.size() - min(data.size(), VERIFY_TAIL))});
+        }
+        const string dec_prefix {"\n^" + site.dec_global + "(\"Subscript 1\",\""};
+        pool.submit(group, [&, archive, which, dec_prefix, data = move(data), dest_path = move(dest_path), fname = move(fname)]() mutable {
+            TraceSpan span(state.profiler, span_names[which]);
+            ZipMember &member = archive->members[which];
+            if (!splice) {
+                if (!deflate_member(data, member.name, member)) compressed.store(false);
+            } else {
+                // Every file ends with the "\n\n" footer, which is deflated once for all of them when they're spliced
+                const Codec &codec = Codec::current();
+                member.crc = Crc32::update(0, data);
+                member.size = data.size();
+                const size_t body = data.size() - 2;
+                bool done = true;
+                if (which == go_ndec) {
+                    done = codec.deflate_part(data.data(), body, archive->ndec_part, DEFLATE_LEVEL);
+                } else if (which == go_dec) {
+                    size_t split = data.find(dec_prefix);
+                    split = split == string::npos ? body : split + 1;
+                    done = codec.deflate_part(data.data(), split, archive->dec_header_part, DEFLATE_LEVEL) &&
+                        codec.deflate_part(data.data() + split, body - split, archive->dec_records_part, DEFLATE_LEVEL);
+                }
+                if (!done) compressed.store(false);
+            }
+            if (state.progress) state.progress->add(Progress::compressed, data.size());
+            if (state.write_go) writer.add(dest_path + fname + ".go", move(data));
+        });
+    };
+    if (!loaded) {
+        if (!generate_go_files(state, compress)) return false;
+    } else {
+        // Loaded from files; all three are ready now.  Largest first, so the combined file isn't the one left waiting
+        // for a free worker
+        const SiteVariant site;
+        compress(site, go_comb, state.comb_codes);
+        compress(site, go_ndec, state.ndec_codes);
+        compress(site, go_dec, state.dec_codes);
+    }
+
+    show_status(state, "Compressing files...");
+    // Compression overlaps generation, so this stage is only the part of it that's left once generation is done
+    {
+        ProfileStage stage(state.profiler, "compress");
+        pool.wait(group);
+        // Spliced entries are put together from their fragments and the footer, which is deflated once for all of them
+        string footer;
+        if (splice && !Codec::current().deflate("\n\n", 2, footer, DEFLATE_LEVEL)) compressed.store(false);
+        for (auto &[key, archive] : archives) {
+            if (!compressed.load()) break;
+            if (splice) {
+                archive.members[go_ndec].deflated = archive.ndec_part + footer;
+                archive.members[go_dec].deflated = archive.dec_header_part + archive.dec_records_part + footer;
+                archive.members[go_comb].deflated = archive.ndec_part + archive.dec_records_part + footer;
+            }
+            vector<vector<ZipMember>> zips;
+            vector<string> zip_paths;
+            for (int i = 0; i < 3; i++) {
+                if (archive.members[i].name.empty()) continue;
+                if (mode != archive_separate && !zips.empty()) {
+                    zips.back().push_back(move(archive.members[i]));
+                    continue;
+                }
+                zips.emplace_back().push_back(move(archive.members[i]));
+                zip_paths.push_back(archive.zip_paths[i]);
+            }
+            for (size_t i = 0; i < zips.size(); i++) {
+                string zip;
+                if (!build_zip(zips[i], zip)) {
+                    compressed.store(false);
+                    break;
+                }
+                writer.add(zip_paths[i], move(zip));
+                for (VerifyJob &it : jobs) {
+                    if (it.zip_path == zip_paths[i]) it.entries = zips[i].size();
+                }
+            }
+        }
+        stage.bytes(bytes_in.load(), 0);
+    }
+    if (!compressed.load()) {
+        cerr << "Unable to compress output files!" << endl;
+        state.outp = OutputCode::write_failed;
+        return false;
+    }
+
+    show_status(state, "Writing files...");
+    {
+        ProfileStage stage(state.profiler, "write");
+        const bool written = writer.flush();
+        stage.bytes(writer.bytes(), writer.bytes());
+        if (!written) {
+            for (const string &it : writer.failed()) cerr << "Unable to write \"" << it << "\"!" << endl;
+            state.outp = OutputCode::write_failed;
+            return false;
+        }
+    }
+
+    // Only drawn for this run's checks
+    const vector<ICDCode> sample {move(state.verify_sample)};
+    state.verify_sample.clear();
+    if (!state.verify) return true;
+
+    show_status(state, "Verifying files...");
+    ProfileStage stage(state.profiler, "verify");
+    atomic<uint64_t> bytes_read {0};
+    vector<string> errors(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.submit(group, [&, i] {
+            TraceSpan span(state.profiler, "verify archive");
+            uint64_t size = 0;
+            verify_archive(jobs[i], sample, size, errors[i]);
+            bytes_read.fetch_add(size, memory_order_relaxed);
+        });
+    }
+    pool.wait(group);
+    stage.bytes(bytes_read.load(), 0);
+    bool verified = true;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (errors[i].empty()) continue;
+        cerr << "Verification of \"" << jobs[i].zip_path << "\" failed: " << errors[i] << endl;
+        verified = false;
+    }
+    if (!verified) {
+        state.outp = OutputCode::verify_failed;
+        return false;
+    }
+
+    return true;
+}
+
+bool serve(ProgramState &state, const string &socket_path) {
+    // Main function
+    LocalServer server;
+    if (!server.listen(socket_path)) {
+        cerr << "Could not listen on \"" << socket_path << "\": " << server.error() << endl;
+        state.outp = OutputCode::daemon_failed;
+        return false;
+    }
+    show_status(state, "Listening on " + socket_path + "...");
+
+    // The warm state.  Parsed code sets by year, so a repeat request skips the download, extraction, and parse, and the
+    // year of the newest release, for requests that don't give one.  The easy handle (and its open connections) and the
+    // worker pool are shared by every request as well
+    map<string, shared_ptr<const vector<ICDCode>>> code_sets;
+    string newest_year;
+
+    bool running = true;
+    while (running && server.accept()) {
+        string line;
+        while (running && server.read_line(line)) {
+            string command;
+            vector<pair<string, string>> args;
+            if (!parse_request(line, command, args)) {
+                server.write_line("error bad-request");
+                continue;
+            }
+            if (command == "ping") {
+                server.write_line("ok");
+                continue;
+            }
+            if (command == "refresh") {
+                code_sets.clear();
+                newest_year.clear();
+                server.write_line("ok");
+                continue;
+            }
+            if (command == "shutdown") {
+                server.write_line("ok");
+                running = false;
+                continue;
+            }
+            if (command != "generate") {
+                server.write_line("error unknown-command");
+                continue;
+            }
+
+            // Each request gets its own state, built from the daemon's settings
+            ProgramState req;
+            copy_settings(state, req);
+            req.keep_codes = true;
+            bool valid = true, year_given = false;
+            for (pair<string, string> &it : args) {
+                if (it.first == "path") {
+                    req.dest_path = move(it.second);
+                    if (req.dest_path.empty() || !filesystem::is_directory(req.dest_path)) valid = false;
+                    else if (req.dest_path.back() != filesystem::path::preferred_separator) req.dest_path.push_back(filesystem::path::preferred_separator);
+                } else if (it.first == "year") {
+                    // Like /y, this sets the year the codes are labeled with; the codes are still the newest release
+                    req.year = move(it.second);
+                    year_given = !req.year.empty();
+                } else if (it.first == "format") {
+                    to_lower(it.second);
+                    if (it.second == "ndec") req.go_files = 1 << go_ndec;
+                    else if (it.second == "dec") req.go_files = 1 << go_dec;
+                    else if (it.second == "comb") req.go_files = 1 << go_comb;
+                    else if (it.second == "all") req.go_files = 7;
+                    else valid = false;
+                } else {
+                    valid = false;
+                }
+            }
+            if (!valid) {
+                server.write_line("error bad-request");
+                continue;
+            }
+            // Sources given on the command line are only good for the first request; after that its codes are warm
+            const bool sourced = !state.zip_file.empty() || !state.order_file.empty() || !state.dec_codes.empty() || !state.ndec_codes.empty() || !state.comb_codes.empty();
+            // Only the newest release can be downloaded, so a year that's neither it nor one already parsed would fetch
+            // the whole bundle just to fail.  It's refused before any of that, unless the sources it's for were given
+            const bool check_year = year_given && !sourced && code_sets.find(req.year) == code_sets.end();
+            if (check_year && newest_year.empty() && state.icd10_url.empty() && state.zip_url.empty()) {
+                // Nothing's been fetched yet, so look the newest year up on the CMS menu.  That's one page, and the
+                // release link it finds is handed on, so the request doesn't fetch it again.  A link given on the
+                // command line has no menu to look at
+                ProgramState probe;
+                copy_settings(state, probe);
+                probe.year.clear();
+                const bool found = get_newest_icd10_link(probe);
+                state.easyhandle = probe.easyhandle;
+                if (!found) {
+                    server.write_line("error " + to_string(probe.outp));
+                    continue;
+                }
+                newest_year = probe.year;
+                if (req.year == newest_year) req.icd10_url = move(probe.icd10_url);
+            }
+            if (check_year && req.year != newest_year) {
+                server.write_line("error unknown-year");
+                continue;
+            }
+            req.zip_file = move(state.zip_file);
+            req.zip_save_path = move(state.zip_save_path);
+            req.order_file = move(state.order_file);
+            req.dec_codes = move(state.dec_codes);
+            req.ndec_codes = move(state.ndec_codes);
+            req.comb_codes = move(state.comb_codes);
+
+            const bool latest = req.year.empty();
+            map<string, shared_ptr<const vector<ICDCode>>>::iterator found = code_sets.find(latest ? newest_year : req.year);
+            if (found != code_sets.end()) {
+                req.year = found->first;
+                req.codes = found->second;
+            }
+            show_status(state, "Generating " + (req.year.empty() ? string("newest") : req.year) + " files in " + req.dest_path + "...");
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            work(req);
+            // A request that needed the network started it, and the handle is kept for the requests after it
+            state.easyhandle = req.easyhandle;
+            const long long elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+            if (req.outp != OutputCode::ok) {
+                server.write_line("error " + to_string(req.outp));
+                continue;
+            }
+            if (req.codes) code_sets[req.year] = req.codes;
+            if (latest) newest_year = req.year;
+            server.write_line("ok " + req.year + " " + to_string(elapsed));
+        }
+    }
     return true;
 }
+
+namespace {
+    // Set by SIGINT or SIGTERM while watch runs
+    volatile sig_atomic_t watch_stop = 0;
+
+    void stop_watch(int sig) {
+        // Support function
+        watch_stop = 1;
+        // Ask once to stop after the current check; ask twice to stop now
+        signal(sig, SIG_DFL);
+    }
+}
+
+bool watch(ProgramState &state, unsigned int interval) {
+    // Main function
+    if (!start_network(state)) return false;
+    const string cms_url {state.cms_base + state.cms_url};
+    // What the last poll found, and what the files were last built from
+    HttpValidator menu_validator, page_validator, zip_validator, built_validator;
+    string icd10_url {state.icd10_url}, zip_url {state.zip_url}, year, built_icd10, built_zip;
+    bool built = false;
+
+    // Returns false if any page couldn't be fetched or parsed.  Pages answered with a 304 keep the links found last time
+    const auto poll = [&]() {
+        // A link given on the command line is used as-is, so there's nothing above it to check
+        if (state.icd10_url.empty() && state.zip_url.empty()) {
+            const long status = conditional_fetch(state, cms_url, menu_validator, false);
+            if (status == 200) {
+                string href, item_text;
+                to_lower(state.working_data);
+                if (!find_icd10_link(state.working_data, href, item_text)) {
+                    cerr << "Could not parse latest ICD-10 url from CMS webpage!" << endl;
+                    return false;
+                }
+                string base_url {href}, href_copy {};
+                // If the found URL can't be parsed, prepend with the cms.gov base URL
+                if (!parse_url(base_url, href_copy)) href = state.cms_base + href;
+                // A different page's validator means nothing to the new one
+                if (href != icd10_url) page_validator = HttpValidator {};
+                icd10_url = move(href);
+                year = item_text.substr(0, 4);
+            } else if (status != 304) {
+                return false;
+            }
+        }
+        if (state.zip_url.empty()) {
+            const long status = conditional_fetch(state, icd10_url, page_validator, false);
+            if (status == 200) {
+                string href;
+                to_lower(state.working_data);
+                if (!find_tab_order_link(state.working_data, href)) {
+                    cerr << "Could not locate link for tabular order zip file!" << endl;
+                    return false;
+                }
+                string base_url {href}, href_copy {};
+                if (!parse_url(base_url, href_copy)) href = state.cms_base + href;
+                if (href != zip_url) zip_validator = HttpValidator {};
+                zip_url = move(href);
+            } else if (status != 304) {
+                return false;
+            }
+        }
+        // Only the headers of the zip; it's downloaded by work if it changed
+        const long status = conditional_fetch(state, zip_url, zip_validator, true);
+        return status == 200 || status == 304;
+    };
+
+    mt19937 rng {random_device {}()};
+    uniform_real_distribution<double> jitter(0.9, 1.1);
+    watch_stop = 0;
+    signal(SIGINT, stop_watch);
+    signal(SIGTERM, stop_watch);
+    while (!watch_stop) {
+        show_status(state, "Checking CMS website for changes...");
+        if (!poll()) {
+            // Start from scratch next time rather than trust anything this poll half-updated
+            menu_validator = page_validator = zip_validator = HttpValidator {};
+            state.outp = OutputCode::cms_get_failed;
+        } else if (!built || icd10_url != built_icd10 || zip_url != built_zip || !(zip_validator == built_validator)) {
+            show_status(state, string("Found ") + (built ? "a change" : "the current release") + ".  Generating files...");
+            // The links are already known, so work skips straight to downloading the zip
+            ProgramState req;
+            copy_settings(state, req);
+            req.icd10_url = icd10_url;
+            req.zip_url = zip_url;
+            if (req.year.empty()) req.year = year;
+            work(req);
+            state.outp = req.outp;
+            if (req.outp == OutputCode::ok) {
+                built = true;
+                built_icd10 = icd10_url;
+                built_zip = zip_url;
+                built_validator = zip_validator;
+            }
+        } else {
+            state.outp = OutputCode::ok;
+            show_status(state, "No change found.");
+        }
+        if (watch_stop) break;
+        const chrono::duration<double> wait {interval * jitter(rng)};
+        ostringstream secs;
+        secs << fixed << setprecision(1) << wait.count();
+        show_status(state, "Checking again in " + secs.str() + " seconds...");
+        // In short naps rather than one long one, so a stop isn't held up until the next check
+        const chrono::steady_clock::time_point until = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(wait);
+        while (!watch_stop && chrono::steady_clock::now() < until) {
+            this_thread::sleep_for(min<chrono::steady_clock::duration>(until - chrono::steady_clock::now(), chrono::milliseconds(WATCH_TICK_MS)));
+        }
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    show_status(state, "Stopped watching.");
+    return state.outp == OutputCode::ok;
+}
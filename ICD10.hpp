@@ -0,0 +1,455 @@
+#pragma once
+
+/****************************************************************************************************************
+* STL includes
+****************************************************************************************************************/
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+
+/****************************************************************************************************************
+* vcpkg includes
+****************************************************************************************************************/
+#include <curl/curl.h>
+
+/****************************************************************************************************************
+* Local includes
+****************************************************************************************************************/
+#include "ArgParser.hpp"
+#include "Profiler.hpp"
+#include "Progress.hpp"
+#include "AsyncIO.hpp"
+#include "OutputWriter.hpp"
+
+/*
+* The pipeline is declared here so that it can be driven by something other than the ICD10 entry point (the benchmark
+* harness in ICD10Bench.cpp, for instance).  Build ICD10.cpp with ICD10_NO_MAIN defined to leave out int main.
+*/
+
+/****************************************************************************************************************
+* Compile-time constants
+****************************************************************************************************************/
+constexpr char DEF_PATH[] = "."; // The default path to use for storing files downloaded and generated
+
+// Visual studio doesn't parse the variable comment correctly if you have // in the following string.  So interrupt the // with "", which get interpreted such that the string continues uninterrupted
+constexpr char CMS_BASE_URL[20] = "https:/""/www.cms.gov"; // The base of the ICD-10 URLs.  The cms.gov links are all relational, so store the base for ease of generating a full link given the end
+
+constexpr char CMS_MAIN_URL[23] = "/medicare/coding/icd10"; // The end portion of the main ICD-10 URL
+
+/******************************************************************************************************************
+ * META-COMMENT:                                                                                                  *
+ * It would probably be better to use icd10cm_codes_yyyy.txt instead of icd10cm_order, but the procedure says use *
+ * icd10cm_order, and I haven't verified that there are no differences                                            *
+ ******************************************************************************************************************/
+constexpr char ORDER_BASE[15] = "icd10cm_order_"; // The base name for the order codes file
+
+constexpr unsigned char IND_CHARS_PER_LINE = 100; // Decimal and non-decimal files are about 100 characters per code
+
+constexpr unsigned char CODES_CHARS_PER_LINE = 240; // ICD-10 codes file has about one hipaa code per 240 characters
+
+constexpr size_t GEN_CHUNK_CODES = 4096; // Codes per generation task.  Small enough to keep every pool worker busy on a real file
+
+constexpr int DEFLATE_LEVEL = 9; // Deflate level for the output zips.  The level libzip used, so the archives stay the same size
+
+constexpr int ZIP_FILE_SIZE = 3145728; // 2.5 MiB
+
+constexpr int ORDER_FILE_SIZE = 15728640; // 15 MiB
+
+constexpr char ARCHIVE_BASE[] = "All versions - Filename_Base_"; // With --single-archive, each site's archive is named prefix+ARCHIVE_BASE+year+".zip"
+
+constexpr size_t VERIFY_SAMPLES = 256; // Codes drawn before generation for verifying; every archive's records are spot checked against all of them
+
+constexpr size_t VERIFY_TAIL = 64; // Bytes at the end of each file kept for verifying that its entry wasn't cut short
+
+constexpr size_t SCAN_WINDOW = 16384; // Bytes of page kept behind the scan for the tabular order link.  Its href is in the tag just before its text
+
+constexpr unsigned int DEF_WATCH_INTERVAL = 3600; // Seconds between checks of the CMS website in watch mode, if the interval given can't be used
+
+constexpr unsigned int WATCH_TICK_MS = 250; // How often watch mode wakes while it waits, to see whether it's been told to stop
+
+constexpr size_t SYNTH_BASE_LINES = 97000; // A real order file has about this many lines; a synthetic file at scale 1 matches it
+
+constexpr char SYNTH_YEAR[] = "2099"; // Default year for synthetic order files, so they can't be mistaken for a real release
+
+constexpr char ZIP_BASE[33] = "-code-descriptions-tabular-order"; // The CMS tabular order zip is named year+ZIP_BASE+".zip"
+
+constexpr char ZIP_PATH[12] = "/files/zip/"; // Where on cms.gov the tabular order zips are kept, for predicting a release's zip link
+
+/****************************************************************************************************************
+* Structs & enums
+****************************************************************************************************************/
+// Conainer for code, decimal code, and description for ICD-10 code
+struct ICDCode {
+    std::string code;
+    std::string dec_code;
+    std::string desc;
+};
+
+// Main program output code enumerator
+enum OutputCode : int {
+    ok,
+    easyhandle_init,
+    cms_get_failed,
+    icd10_get_failed,
+    zip_get_failed,
+    icd10_find_failed,
+    zip_find_failed,
+    extract_file_failed,
+    generate_failed,
+    write_failed,
+    daemon_failed,
+    verify_failed,
+    offline,
+};
+
+// Which of the three .go files a buffer is
+enum GoFile : int {
+    go_ndec,
+    go_dec,
+    go_comb,
+};
+
+// Called on a pool worker as soon as one .go file is complete.  The callee may take the buffer (move from it)
+using GoFileReady = std::function<void(GoFile which, std::string &data)>;
+
+// One receiving site's variant of the output files, from a line of the --sites manifest.  The defaults are the files
+// every site got before there were variants
+struct SiteVariant {
+    std::string name {}; // Name shown in console output
+    std::string dest_path {}; // Where this site's files go.  Empty for ProgramState::dest_path
+    std::string dec_global {"DECGBL"}; // Global the decimal records are set in
+    std::string ndec_global {"NONDECGBL"}; // Global the non-decimal records are set in
+    std::string fname_prefix {}; // Prepended to each output file name
+};
+
+// One entry of a written archive to verify
+struct VerifyJob {
+    std::string zip_path; // The archive on disk
+    std::string entry_name; // The entry to check
+    SiteVariant site; // The site it was generated for, for its global names
+    GoFile which; // Which .go file the entry is
+    size_t entries = 1; // How many entries the archive should hold
+    std::string tail {}; // The last VERIFY_TAIL bytes of the file as it was compressed, generated or loaded
+};
+
+// A downloaded file being saved on the worker pool while the pipeline carries on.  It owns the data until the save is done,
+// and the file stays under its temp name until the run is known to have succeeded
+struct BackgroundSave {
+    std::string path {};
+    std::string data {}; // Only ever read, by the save and the pipeline alike
+    OutputWriter writer {};
+    std::optional<Async<bool>> task {};
+};
+
+// How work packages the .go files
+enum ArchiveMode : int {
+    archive_separate, // One archive per file
+    archive_single, // One archive per site holding all of the files
+};
+
+// One zip entry, deflated and ready to be laid out by build_zip
+struct ZipMember {
+    std::string name {}; // Entry name
+    uint32_t crc = 0; // CRC-32 of the uncompressed data
+    uint64_t size = 0; // Uncompressed size
+    std::string deflated {}; // Raw deflate stream
+};
+
+// Like GoFileReady, but also says which site the file is for
+using SiteFileReady = std::function<void(const SiteVariant &site, GoFile which, std::string &data)>;
+
+// What a server said identifies the current version of a resource, for conditional requests.  Any of them changing means
+// the resource changed
+struct HttpValidator {
+    std::string etag {}; // ETag header, sent back as If-None-Match
+    std::string last_modified {}; // Last-Modified header, sent back as If-Modified-Since
+    int64_t length = -1; // Content-Length, for servers that send neither of the others.  -1 if not given
+    bool operator==(const HttpValidator &) const = default;
+};
+
+// A link being looked for in a page as it arrives.  Only the part of the page the link could still be in is kept, and
+// the transfer is stopped as soon as it's settled
+struct LinkScanner {
+    enum Target { icd10_link, tab_order_link } target; // The link find_icd10_link or find_tab_order_link looks for
+    std::string window {}; // Lower-cased page text the link could still be in
+    std::string href {}, text {}; // The link, and its text for icd10_link
+    bool done {}; // Set once the page can't change the result, whether or not the link was found
+    bool found {};
+    uint64_t bytes {}; // Decoded page bytes scanned
+    uint64_t wire_bytes {}; // Page bytes as they came over the network, before decoding
+};
+
+// Knobs for generating a synthetic order file.  The same options always produce the same file
+struct SynthOptions {
+    double scale = 1.0; // Number of lines as a multiple of SYNTH_BASE_LINES
+    double hipaa_ratio = 0.76; // Fraction of lines flagged as hipaa codes (about what the real file has)
+    std::string line_end {"\n"}; // Line ending: "\n", "\r\n", or "\r"
+    size_t desc_len = 100; // Average long description length.  Lengths are spread from half to one and a half times this
+    unsigned int seed = 0; // Seed for the random number generator
+};
+
+// This is just a package to hold all of the information to be passed between functions.
+// All of the main functions take a ProgramState by reference
+struct ProgramState {
+    CURL *easyhandle = nullptr; // The CURL easy handle for CURL queries
+    bool disp {}; // Flag to turn on or off writing output to stdout
+    std::string dest_path {}; // The path into which to place generated and downloaded files.  Default is DEF_PATH
+    std::string cms_base {}; // The base URL for the cms.gov website.  Default is CMS_BASE_URL
+    std::string cms_url {}; // The relational URL for the ICD-10 page on the cms.gov website.  Default is CMS_MAIN_URL
+    std::string icd10_url {}; // The relational URL for the current most recent tabular order ICD-10 code page
+    std::string zip_url {}; // The relational URL for the link to the tabular order zip file
+    std::string zip_fname {}; // The filename of the current tabular order zip file
+    std::string zip_file {}; // The current tabular order zip file (raw data)
+    bool zip_rebuilt {}; // Whether zip_file is a one-entry archive rebuilt around the order file, rather than the whole CMS zip
+    std::string zip_save_path {}; // Where to save the downloaded zip file.  It's written in the background while the pipeline runs
+    std::shared_ptr<BackgroundSave> zip_save {}; // The downloaded zip, while it's being saved.  Joined by finish_zip_save
+    std::string order_file {}; // The order codes file from the current zip file
+    std::string dec_codes {}; // Output format decimal codes file
+    std::string ndec_codes {}; // Output format non-decimal codes file
+    std::string comb_codes {}; // Output format combined (decimal and non-decimal) codes file
+    std::string year {}; // The year of the most recent ICD-10 codes
+    std::string working_data {}; // Scratch string for loading web pages into
+    int outp = OutputCode::ok; // Current output code for the program
+    Profiler *profiler = nullptr; // Stage instrumentation.  Only set when --profile or --profile-json is given
+    Progress *progress = nullptr; // Status messages and the progress line.  Only set when output isn't suppressed with /q
+    EventLoop *loop = nullptr; // Runs the network transfers and background file writes
+    bool write_go {}; // Flag to also write the uncompressed .go files
+    unsigned char go_files = 7; // Which .go files to produce, as a bitmask of 1 << GoFile.  Default is all three
+    bool keep_codes {}; // Flag to keep the parsed code set in codes after generating, for the next request in daemon mode
+    std::shared_ptr<const std::vector<ICDCode>> codes {}; // Parsed and sorted codes.  If set, generate_go_files uses these as-is
+    std::vector<SiteVariant> sites {}; // Sites to generate variants for, all from one parse.  Empty for one default site
+    bool verify = true; // Flag to re-read and check every archive once it's written
+    std::vector<ICDCode> verify_sample {}; // Random codes drawn for verify's spot checks, so the full set can still be freed
+    ArchiveMode archive_mode = archive_separate; // How the .go files are packaged
+    bool offline {}; // Flag to never touch the network.  Anything that would need it fails instead
+    bool full_zip {}; // Flag to download the whole tabular order zip, instead of range requesting only the order file
+    bool direct_io {}; // Flag to write large output files with O_DIRECT
+};
+
+/****************************************************************************************************************
+* Support functions
+****************************************************************************************************************/
+// Convert a string to all lower case
+void to_lower(std::string &input);
+
+// Check that name can be used as a global name: a letter or % followed by letters and digits
+bool valid_global(const std::string &name);
+
+// Parse a --sites manifest into sites.  One site per line: "site name=Name [path=Directory] [dec-global=Global]
+// [ndec-global=Global] [prefix=Prefix]".  Blank lines and lines starting with # are skipped.  On failure, error says why
+bool parse_sites(const std::string &data, std::vector<SiteVariant> &sites, std::string &error);
+
+// Split a daemon request line into its command and its key=value arguments.  Keys and the command are lower-cased
+bool parse_request(const std::string &line, std::string &command, std::vector<std::pair<std::string, std::string>> &args);
+
+// CURL transfer info callback.  Sets the download counters of the Progress in clientp
+int download_progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+// Feed the page data received into the LinkScanner in userdata.  Stops the transfer once the scanner is done
+size_t receive_page(char *data, size_t size, size_t nmemb, LinkScanner *userdata);
+
+// Run the transfer set up on state.easyhandle on state.loop, inside a trace span
+CURLcode traced_perform(ProgramState &state);
+
+// Send a HEAD request for each of urls (in order of preference) at once, each on the easy handle at the same index of
+// handles.  hit is set to the index of the first of them that answers 200, or npos if none do.  As soon as one is known
+// to win, the probes that lost are abandoned.  Resolves to whether there was a hit
+Async<bool> probe_zip_links(EventLoop &loop, std::vector<CURL *> handles, std::vector<std::string> urls, size_t &hit);
+
+// Probe urls with probe_zip_links, then download the zip at the hit into outp with download_zip (entries holds each
+// one's order file name).  Gives up before any transfer once stop is set, or once listed (the link the CMS page gives,
+// empty until it's read) turns out to be another url.  rebuilt is set as download_zip sets it.  Resolves to whether the
+// zip was downloaded
+Async<bool> fetch_predicted_zip(EventLoop &loop, std::vector<CURL *> handles, std::vector<std::string> urls, std::vector<std::string> entries, bool full, const bool &stop, const std::string &listed, size_t &hit, std::string &outp, bool &rebuilt);
+
+// Fetch the page at url straight into scanner, with a compressed transfer if the server will do one.  Returns
+// CURLE_OK if the scanner saw either the whole page or everything it needed
+CURLcode scan_page(ProgramState &state, const std::string &url, LinkScanner &scanner);
+
+// Fetch url into state.working_data (or only its headers, if head), sending validator back so an unchanged resource is
+// answered with a 304 and no body.  validator is updated from a 200.  Returns the HTTP status, or 0 if the transfer failed
+long conditional_fetch(ProgramState &state, const std::string &url, HttpValidator &validator, bool head);
+
+// Fetch the byte range given (in Range header form, "first-last" or "-suffix") of url into outp, on easy.  total is set
+// to the size of the whole resource from Content-Range.  Resolves to the HTTP status (206 if the range was honored, 200
+// if the server sent everything instead), or 0 if the transfer failed or stop was already set
+Async<long> range_fetch(EventLoop &loop, CURL *easy, std::string url, std::string range, const bool &stop, std::string &outp, uint64_t &total);
+
+// Fetch only the entry entry_name (matched as uncompress_data matches it) of the zip archive at url, with range requests
+// for the end of central directory record, the central directory, and the entry, and rebuild it into a one-entry archive
+// in outp, setting rebuilt.  If the server doesn't do ranges, outp holds the whole archive instead and rebuilt is cleared.
+// Returns false if neither worked, or the archive needs zip64.  Runs on easy, and stops before the next transfer once stop
+// is set
+Async<bool> fetch_zip_entry(EventLoop &loop, CURL *easy, std::string url, std::string entry_name, const bool &stop, std::string &outp, bool &rebuilt);
+
+// Download the zip at url into outp on easy: only the entry entry_name with fetch_zip_entry, unless full is set or that
+// fails, and otherwise the whole archive.  rebuilt is set if outp is only that entry, in an archive of its own.  Stops
+// before the next transfer once stop is set.  Resolves to the result of the last transfer
+Async<CURLcode> download_zip(EventLoop &loop, CURL *easy, std::string url, std::string entry_name, bool full, const bool &stop, std::string &outp, bool &rebuilt);
+
+// Copy the settings (not the sources or results) of one state into another, for running the pipeline more than once
+void copy_settings(const ProgramState &from, ProgramState &to);
+
+// Wait for the background save of the downloaded zip, if there is one, then publish it if state.outp is still ok, or throw it
+// away if the run failed.  Reports and returns false if it couldn't be saved
+bool finish_zip_save(ProgramState &state);
+
+// Show a status message through state.progress, or straight to stdout if there's no reporter and output is on
+void show_status(const ProgramState &state, const std::string &text);
+
+// Write data to fname's temp file through writer on the worker pool, staged for writer.publish or writer.discard.  data must
+// stay alive until the returned task is done
+Async<bool> stage_file_async(EventLoop &loop, OutputWriter &writer, std::string fname, const std::string &data, Profiler *profiler = nullptr);
+
+// Initialize a CURL easy handle
+bool init_easy_handle(ProgramState &state);
+
+// Initialize curl and state.easyhandle, the first time anything needs the network.  Fails (setting state.outp) if they
+// can't be, or if state.offline is set
+bool start_network(ProgramState &state);
+
+// Load the zip file from fspath into state.zip_file.  Get the year from parser, if it was found; if not, derive from fspath
+bool load_zip_file(ProgramState &state, const ArgParser &parser, const std::filesystem::path &fspath);
+
+// Load the text file from fspath into file
+bool load_text_file(std::string &file, const std::filesystem::path &fspath);
+
+// Load the files specified in parser into state.dec_codes, state.ndec codes, and state.comb codes if possible.
+// Return 0 on success
+// Return 1 if dec codes can't be loaded
+// Return 2 if non-dec codes can't be loaded
+// Return 3 if comb codes can't be loaded
+char load_go_files(ProgramState &state, const ArgParser &parser);
+
+// Take the url from base and strip the relational URL into url
+// For example:
+// string a="https://www.cms.gov/medicare/coding/icd10", b{};
+// parse_url(a, b);
+// a == "https://www.cms.gov";
+// b == "/medicare/coding/icd10";
+bool parse_url(std::string &base, std::string &url);
+
+// Scan the (lower-cased) CMS landing page for the ICD-10 CM menu link.  On success, href holds the link and text holds
+// the link text (which starts with the year)
+bool find_icd10_link(const std::string &page, std::string &href, std::string &text);
+
+// Scan the (lower-cased) ICD-10 CM page for the tabular order zip link.  On success, href holds the link
+bool find_tab_order_link(const std::string &page, std::string &href);
+
+// Add the next length bytes of a page to scanner, and look for its link in what it has so far
+void scan_chunk(LinkScanner &scanner, const char *data, size_t length);
+
+// Uncompress the file fname from the zip file held in data into outp, inflating with the current Codec and checking the
+// CRC.  Entries the codecs can't read directly are handed to uncompress_data_libzip
+bool uncompress_data(const std::string &data, const std::string &fname, std::string &outp);
+
+// Uncompress the file fname from the zip file held in data into outp through libzip
+bool uncompress_data_libzip(const std::string &data, const std::string &fname, std::string &outp);
+
+// Binary search the sorted .go records in data[lo, hi) for the one whose subscript is key.  prefix is "\n^", the global,
+// and the subscript up to the key.  Returns the offset of the record's ^, or npos if it isn't there
+size_t find_record(const std::string &data, size_t lo, size_t hi, const std::string &prefix, const std::string &key);
+
+// Re-read the archive job describes from disk and check its structure and CRC, then look up each code in sample and
+// check that its records are there, exactly as generated.  size is set to the bytes read.  On failure, error says why
+bool verify_archive(const VerifyJob &job, const std::vector<ICDCode> &sample, uint64_t &size, std::string &error);
+
+// Get the fixed time to stamp output with from SOURCE_DATE_EPOCH (seconds since 1970, UTC) into when.  Returns false if
+// it isn't set or can't be parsed, in which case output is stamped with the current time
+bool source_date_epoch(time_t &when);
+
+// Find the end of central directory record in the zip archive held in data.  Returns npos if there isn't one
+size_t find_eocd(const std::string &data);
+
+// Convert when to the DOS time and date zip headers use, in UTC if utc is set and local time otherwise
+void dos_datetime(time_t when, bool utc, uint16_t &dos_time, uint16_t &dos_date);
+
+// Deflate data with the current Codec into member, as an entry named name
+bool deflate_member(const std::string &data, const std::string &name, ZipMember &member);
+
+// Lay out an in-memory zip archive in outp holding members, in order.  Every entry is stamped with SOURCE_DATE_EPOCH in UTC
+// if it's set, and with the current local time otherwise
+bool build_zip(const std::vector<ZipMember> &members, std::string &outp);
+
+// Compress data with the current Codec into an in-memory zip archive in outp, as a single entry named fil_name
+bool compress_buffer(const std::string &data, const std::string &fil_name, std::string &outp);
+
+// Compress data into a new zip file at zip_name, as a single entry named fil_name
+bool compress_entry(const std::string &data, const std::string &zip_name, const std::string &fil_name);
+
+// Compress data as an entry named fname+ext into base_path+fname+".zip".  If writer is given, the archive is queued on it
+// to be written with its next flush; otherwise it's written now
+bool compress_data(const std::string &data, std::string &base_path, std::string fname, std::string ext, OutputWriter *writer = nullptr);
+
+// Generate a syntactically valid synthetic order file into outp
+void gen_order_file(std::string &outp, const SynthOptions &opts);
+
+// Parse the hipaa codes out of the order file held in data into codes.  The codes are left in file order
+void parse_codes(const std::string &data, std::vector<ICDCode> &codes);
+
+// Sort codes by code
+void sort_codes(std::vector<ICDCode> &codes);
+
+// Generate go file from codes into outp.  Read date information from year, timestamp, and dj
+// For bitmask, 1 = decimal file, 2 = append ending newlines, 4 = prepend header.  Combine using bitwise or.
+// Global names are taken from site
+void gen_go_file(std::string *outp, std::vector<ICDCode> const *codes, std::string const *year, tm *timestamp, std::string *dj, char bitmask, const SiteVariant &site = SiteVariant {});
+
+// Append the .go records for the codes in [first, last) to outp, in decimal format if decimal is set
+void gen_go_records(std::string &outp, const ICDCode *first, const ICDCode *last, bool decimal, const SiteVariant &site = SiteVariant {});
+
+// Generate the decimal, non-decimal, and combined .go files from codes as a task graph on the worker pool.  If ready is
+// given, it's called for each file the moment that file is finished, while the others are still being generated.  If
+// profiler is given, each task is traced, and if progress is given, each chunk of records is counted.  Global names are
+// taken from site.  The header is stamped with the current local time, or with SOURCE_DATE_EPOCH in UTC if it's set
+void gen_files(const std::vector<ICDCode> &codes, const std::string &year, std::string &dec, std::string &ndec, std::string &comb, Profiler *profiler = nullptr, const GoFileReady &ready = nullptr, const SiteVariant &site = SiteVariant {}, Progress *progress = nullptr);
+
+/****************************************************************************************************************
+* Main functions
+****************************************************************************************************************/
+// Get the latest ICD-10 page link from the cms.gov website
+bool get_newest_icd10_link(ProgramState &state);
+
+// Get the link to the tabular order zip file from the latest ICD-10 CM page
+bool get_tab_order_zip_link(ProgramState &state);
+
+// Find the tabular order zip file link.  When looking for the newest release, this year's and next year's predicted zip
+// links are probed while the pages are scraped, and whichever finds the zip first stops the other
+bool find_zip_link(ProgramState &state);
+
+// Download the zip file from the tabular order zip file link
+bool get_zip_file(ProgramState &state);
+
+// Extract the order codes file from the tabular order zip file
+bool get_codes_file(ProgramState &state);
+
+// Generate .go files for decimal, non-decimal, and combined codes, once for each of state.sites from the same code set.
+// The sites are generated in parallel, one pool task each.  ready is passed through to gen_files, so it's called from
+// any worker, for any site, at any time until this returns
+bool generate_go_files(ProgramState &state, const SiteFileReady &ready = nullptr);
+
+// Generate a synthetic order file and a matching tabular order zip into state.dest_path
+bool generate_order_file(ProgramState &state, const SynthOptions &opts);
+
+// Main work function used by the program.  Take state and compress dec_codes, ndec_codes, and comb_codes into zip files
+bool work(ProgramState &state);
+
+// Run as a daemon on the local socket at socket_path, answering one request per line until told to shut down.  Requests:
+//   generate [path=Directory] [year=Year] [format=dec|ndec|comb|all]  Answered with "ok Year Milliseconds" or "error Code"
+//   refresh   Forget the warm code sets, so the next request downloads the newest release again
+//   ping      Answered with "ok"
+//   shutdown  Answered with "ok", then the daemon exits
+// Values may be quoted.  The code set for each year is kept warm between requests, as is state.easyhandle
+bool serve(ProgramState &state, const std::string &socket_path);
+
+// Poll the CMS pages every interval seconds (give or take a tenth, so many watchers don't line up) with conditional
+// requests, and run work when the ICD-10 link, the zip link, or the zip itself changes.  Also runs on the first poll.
+// Runs until SIGINT or SIGTERM, which lets the check in progress finish (a second one stops it at once).  Returns true if
+// the last check succeeded
+bool watch(ProgramState &state, unsigned int interval);
@@ -0,0 +1,400 @@
+/****************************************************************************************************************
+* STL includes
+****************************************************************************************************************/
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+
+/****************************************************************************************************************
+* vcpkg includes
+****************************************************************************************************************/
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+/****************************************************************************************************************
+* Local includes
+****************************************************************************************************************/
+#include "ICD10.hpp"
+#include "Crc32.hpp"
+#include "Codec.hpp"
+
+/*
+* Per-stage benchmarks for the ICD-10 pipeline.  Everything runs offline from the synthetic order file checked in at
+* Benchmark\icd10cm_order_2099.txt (or any order file passed as the last argument), so the numbers don't depend on the
+* network or on whichever CMS zip was last downloaded.  The *_scaled benchmarks run the heavy stages against synthetic
+* order files from gen_order_file at 1x to 8x the size of a real one, to show how each stage scales.
+*
+* Build the ICD10Bench project in ICD10.sln, then run ICD10Bench [--benchmark_filter=...] [order file].  Define
+* ICD10_WITH_LIBDEFLATE and/or ICD10_WITH_ZLIB_NG to benchmark those codecs as well.  The deflate/<codec> and
+* inflate/<codec> rows are one per codec built in, run on the order file, for comparing them.
+*/
+
+using namespace std;
+
+
+/****************************************************************************************************************
+* Compile-time constants
+****************************************************************************************************************/
+constexpr char BENCH_ORDER_FILE[] = "Benchmark/icd10cm_order_2099.txt"; // The default synthetic order file
+
+constexpr char BENCH_YEAR[] = "2099"; // The year of the default synthetic order file
+
+// Landing page fixture for find_icd10_link.  Padded out with filler menus to roughly the size of the real cms.gov page
+constexpr char BENCH_CMS_PAGE[] =
+    "<ul class=\"menu\"><li><a href=\"/medicare/coding/icd10/2099-icd-10-pcs\">2099 ICD-10-PCS</a></li>"
+    "<li><a href=\"/medicare/coding/icd10/2098-icd-10-pcs\">2098 ICD-10-PCS</a></li>"
+    "<li><a href=\"/medicare/coding/icd10/2099-icd-10-cm\">2099 ICD-10-CM</a></li></ul>";
+
+// ICD-10 CM page fixture for find_tab_order_link
+constexpr char BENCH_ICD10_PAGE[] =
+    "<li><a href=\"/files/zip/2099-code-descriptions-tabular-order.zip\">2099 Code Descriptions in Tabular Order (ZIP)</a></li>";
+
+constexpr size_t BENCH_PAGE_FILLER = 2000; // Number of filler list items wrapped around each page fixture
+
+constexpr int BENCH_MAX_SCALE = 8; // Largest synthetic order file for the scaled benchmarks, as a multiple of a real one
+
+/****************************************************************************************************************
+* Structs & enums
+****************************************************************************************************************/
+// Inputs for every stage, built once from the order file and shared (read only) by all of the benchmarks
+struct BenchData {
+    string order_file {}; // The raw order file
+    string zip_file {}; // The order file compressed the same way the CMS bundle is
+    string order_fname {}; // The name of the order file inside zip_file
+    string cms_page {}; // Lower-cased landing page
+    string icd10_page {}; // Lower-cased ICD-10 CM page
+    vector<ICDCode> parsed_codes {}; // Codes as they come out of parse_codes (file order)
+    vector<ICDCode> codes {}; // Sorted codes
+    string dec_codes {}; // Output format decimal codes file
+    string ndec_codes {}; // Output format non-decimal codes file
+    string comb_codes {}; // Output format combined codes file
+    string year {BENCH_YEAR}; // Year used for generation
+    string scratch_path {}; // Directory for the archives written by compress_data, with a trailing separator
+};
+
+// Stage inputs generated from a synthetic order file at a given scale
+struct ScaledData {
+    int scale = 0; // Scale the data was generated at; 0 until built
+    string order_file {}; // The synthetic order file
+    vector<ICDCode> parsed_codes {}; // Codes as they come out of parse_codes (file order)
+    vector<ICDCode> codes {}; // Sorted codes
+    string comb_codes {}; // Output format combined codes file
+};
+
+/****************************************************************************************************************
+* Support functions
+****************************************************************************************************************/
+// Path to the order file; set from the command line in main
+string bench_order_path {BENCH_ORDER_FILE};
+
+// Read fspath into file without any newline translation
+bool read_binary_file(string &file, const filesystem::path &fspath) {
+    // Support function
+    ifstream fil(fspath, ios::binary | ios::in | ios::ate);
+    if (!fil) return false;
+    streampos num_char = fil.tellg();
+    streambuf *buf = fil.rdbuf();
+    buf->pubseekoff(0, ios::beg);
+    file.resize(static_cast<size_t>(num_char));
+    file.resize(static_cast<size_t>(buf->sgetn(file.data(), num_char)));
+    return true;
+}
+
+// Wrap the link in filler so the scanners have a realistic amount of page to get through
+string pad_page(const string &body) {
+    // Support function
+    string page {"<html><body><ul class=\"nav\">"};
+    for (size_t i = 0; i < BENCH_PAGE_FILLER; i++) page.append("<li><a href=\"/filler/").append(to_string(i)).append("\">filler link</a></li>");
+    page.append("</ul>").append(body);
+    for (size_t i = 0; i < BENCH_PAGE_FILLER; i++) page.append("<p>filler paragraph ").append(to_string(i)).append("</p>");
+    page.append("</body></html>");
+    to_lower(page);
+    return page;
+}
+
+// Build the shared fixture data the first time it's asked for
+const BenchData &bench_data() {
+    // Support function
+    static const BenchData data = [] {
+        BenchData out;
+        if (!read_binary_file(out.order_file, bench_order_path) || out.order_file.empty()) {
+            cerr << "Could not load order file \"" << bench_order_path << "\"!" << endl;
+            exit(1);
+        }
+        string fname = filesystem::path(bench_order_path).stem().string();
+        if (fname.size() >= 4) out.year = fname.substr(fname.size() - 4);
+        out.order_fname = fname + ".txt";
+
+        filesystem::path scratch = filesystem::temp_directory_path() / "icd10_bench";
+        filesystem::create_directories(scratch);
+        out.scratch_path = scratch.string();
+        out.scratch_path.push_back(filesystem::path::preferred_separator);
+        compress_data(out.order_file, out.scratch_path, fname, ".txt");
+        if (!read_binary_file(out.zip_file, scratch / (fname + ".zip"))) {
+            cerr << "Could not build zip fixture in \"" << out.scratch_path << "\"!" << endl;
+            exit(1);
+        }
+
+        out.cms_page = pad_page(BENCH_CMS_PAGE);
+        out.icd10_page = pad_page(BENCH_ICD10_PAGE);
+
+        parse_codes(out.order_file, out.parsed_codes);
+        out.codes = out.parsed_codes;
+        sort_codes(out.codes);
+        gen_files(out.codes, out.year, out.dec_codes, out.ndec_codes, out.comb_codes);
+        return out;
+    }();
+    return data;
+}
+
+// Build the data for scale, replacing whatever scale was built last.  Only one scale is kept at a time so the larger
+// ones don't pile up in memory
+const ScaledData &scaled_data(int scale) {
+    // Support function
+    static ScaledData data;
+    if (data.scale != scale) {
+        data = ScaledData();
+        SynthOptions opts;
+        opts.scale = scale;
+        gen_order_file(data.order_file, opts);
+        parse_codes(data.order_file, data.parsed_codes);
+        data.codes = data.parsed_codes;
+        sort_codes(data.codes);
+        string dec, ndec;
+        gen_files(data.codes, SYNTH_YEAR, dec, ndec, data.comb_codes);
+        data.scale = scale;
+    }
+    return data;
+}
+
+/****************************************************************************************************************
+* Fixtures
+****************************************************************************************************************/
+// Every benchmark runs against the same shared data; SetUp just makes sure it's been built before timing starts
+class PipelineFixture : public benchmark::Fixture {
+public:
+    void SetUp(const benchmark::State &) override { data = &bench_data(); }
+protected:
+    const BenchData *data = nullptr;
+};
+
+// Same idea as PipelineFixture, but the data comes from a synthetic order file at the scale given by the benchmark's arg
+class ScaledFixture : public benchmark::Fixture {
+public:
+    void SetUp(const benchmark::State &st) override { data = &scaled_data(static_cast<int>(st.range(0))); }
+protected:
+    const ScaledData *data = nullptr;
+};
+
+/****************************************************************************************************************
+* Benchmarks
+****************************************************************************************************************/
+BENCHMARK_F(PipelineFixture, parse_url)(benchmark::State &st) {
+    const string full_url {string(CMS_BASE_URL) + CMS_MAIN_URL};
+    for (auto _ : st) {
+        string base {full_url}, url {};
+        benchmark::DoNotOptimize(parse_url(base, url));
+        benchmark::DoNotOptimize(url);
+    }
+    st.SetBytesProcessed(st.iterations() * full_url.size());
+}
+
+BENCHMARK_F(PipelineFixture, find_icd10_link)(benchmark::State &st) {
+    for (auto _ : st) {
+        string href, text;
+        benchmark::DoNotOptimize(find_icd10_link(data->cms_page, href, text));
+        benchmark::DoNotOptimize(href);
+    }
+    st.SetBytesProcessed(st.iterations() * data->cms_page.size());
+}
+
+BENCHMARK_F(PipelineFixture, find_tab_order_link)(benchmark::State &st) {
+    for (auto _ : st) {
+        string href;
+        benchmark::DoNotOptimize(find_tab_order_link(data->icd10_page, href));
+        benchmark::DoNotOptimize(href);
+    }
+    st.SetBytesProcessed(st.iterations() * data->icd10_page.size());
+}
+
+BENCHMARK_F(PipelineFixture, uncompress_data)(benchmark::State &st) {
+    for (auto _ : st) {
+        string outp;
+        benchmark::DoNotOptimize(uncompress_data(data->zip_file, data->order_fname, outp));
+        benchmark::DoNotOptimize(outp);
+    }
+    // Report throughput in terms of inflated bytes
+    st.SetBytesProcessed(st.iterations() * data->order_file.size());
+}
+
+BENCHMARK_F(PipelineFixture, parse_codes)(benchmark::State &st) {
+    for (auto _ : st) {
+        vector<ICDCode> codes;
+        parse_codes(data->order_file, codes);
+        benchmark::DoNotOptimize(codes.data());
+    }
+    st.SetBytesProcessed(st.iterations() * data->order_file.size());
+    st.SetItemsProcessed(st.iterations() * data->parsed_codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, sort_codes)(benchmark::State &st) {
+    for (auto _ : st) {
+        // Each iteration needs the unsorted input again; don't count the copy
+        st.PauseTiming();
+        vector<ICDCode> codes {data->parsed_codes};
+        st.ResumeTiming();
+        sort_codes(codes);
+        benchmark::DoNotOptimize(codes.data());
+    }
+    st.SetItemsProcessed(st.iterations() * data->parsed_codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, gen_go_file)(benchmark::State &st) {
+    tm timestamp {};
+    string dj {"12345"};
+    size_t bytes = 0;
+    for (auto _ : st) {
+        string outp;
+        // 7 = decimal, with header and footer
+        gen_go_file(&outp, &data->codes, &data->year, &timestamp, &dj, 7);
+        bytes = outp.size();
+        benchmark::DoNotOptimize(outp);
+    }
+    st.SetBytesProcessed(st.iterations() * bytes);
+    st.SetItemsProcessed(st.iterations() * data->codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, gen_files)(benchmark::State &st) {
+    for (auto _ : st) {
+        string dec, ndec, comb;
+        gen_files(data->codes, data->year, dec, ndec, comb);
+        benchmark::DoNotOptimize(comb);
+    }
+    st.SetBytesProcessed(st.iterations() * (data->dec_codes.size() + data->ndec_codes.size() + data->comb_codes.size()));
+    st.SetItemsProcessed(st.iterations() * data->codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, compress_data)(benchmark::State &st) {
+    string base_path {data->scratch_path};
+    for (auto _ : st) {
+        // Largest of the three outputs, so it's the long pole in work
+        compress_data(data->comb_codes, base_path, "Combined version - Filename_Base_" + data->year, ".go");
+    }
+    st.SetBytesProcessed(st.iterations() * data->comb_codes.size());
+}
+
+// CRC-32 over the combined file: zlib's (what libzip uses), the portable table kernel, and the kernel Crc32 picked for
+// this CPU (reported as the label)
+BENCHMARK_F(PipelineFixture, crc32_zlib)(benchmark::State &st) {
+    for (auto _ : st) {
+        benchmark::DoNotOptimize(crc32_z(0, reinterpret_cast<const Bytef *>(data->comb_codes.data()), data->comb_codes.size()));
+    }
+    st.SetBytesProcessed(st.iterations() * data->comb_codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, crc32_portable)(benchmark::State &st) {
+    for (auto _ : st) {
+        benchmark::DoNotOptimize(Crc32::portable(0, data->comb_codes.data(), data->comb_codes.size()));
+    }
+    st.SetBytesProcessed(st.iterations() * data->comb_codes.size());
+}
+
+BENCHMARK_F(PipelineFixture, crc32_update)(benchmark::State &st) {
+    for (auto _ : st) {
+        benchmark::DoNotOptimize(Crc32::update(0, data->comb_codes));
+    }
+    st.SetBytesProcessed(st.iterations() * data->comb_codes.size());
+    st.SetLabel(Crc32::kernel());
+}
+
+BENCHMARK_DEFINE_F(ScaledFixture, parse_codes_scaled)(benchmark::State &st) {
+    for (auto _ : st) {
+        vector<ICDCode> codes;
+        parse_codes(data->order_file, codes);
+        benchmark::DoNotOptimize(codes.data());
+    }
+    st.SetBytesProcessed(st.iterations() * data->order_file.size());
+    st.SetItemsProcessed(st.iterations() * data->parsed_codes.size());
+}
+BENCHMARK_REGISTER_F(ScaledFixture, parse_codes_scaled)->RangeMultiplier(2)->Range(1, BENCH_MAX_SCALE)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_DEFINE_F(ScaledFixture, sort_codes_scaled)(benchmark::State &st) {
+    for (auto _ : st) {
+        st.PauseTiming();
+        vector<ICDCode> codes {data->parsed_codes};
+        st.ResumeTiming();
+        sort_codes(codes);
+        benchmark::DoNotOptimize(codes.data());
+    }
+    st.SetItemsProcessed(st.iterations() * data->parsed_codes.size());
+}
+BENCHMARK_REGISTER_F(ScaledFixture, sort_codes_scaled)->RangeMultiplier(2)->Range(1, BENCH_MAX_SCALE)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_DEFINE_F(ScaledFixture, gen_files_scaled)(benchmark::State &st) {
+    size_t bytes = 0;
+    for (auto _ : st) {
+        string dec, ndec, comb;
+        gen_files(data->codes, SYNTH_YEAR, dec, ndec, comb);
+        bytes = dec.size() + ndec.size() + comb.size();
+        benchmark::DoNotOptimize(comb);
+    }
+    st.SetBytesProcessed(st.iterations() * bytes);
+    st.SetItemsProcessed(st.iterations() * data->codes.size());
+}
+BENCHMARK_REGISTER_F(ScaledFixture, gen_files_scaled)->RangeMultiplier(2)->Range(1, BENCH_MAX_SCALE)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_DEFINE_F(ScaledFixture, compress_data_scaled)(benchmark::State &st) {
+    string base_path {bench_data().scratch_path};
+    for (auto _ : st) {
+        compress_data(data->comb_codes, base_path, "Combined version - Filename_Base_" + string(SYNTH_YEAR), ".go");
+    }
+    st.SetBytesProcessed(st.iterations() * data->comb_codes.size());
+}
+BENCHMARK_REGISTER_F(ScaledFixture, compress_data_scaled)->RangeMultiplier(2)->Range(1, BENCH_MAX_SCALE)->Unit(benchmark::kMillisecond);
+
+// Deflate and inflate the order file with one codec.  Registered in main, once for each codec built in.  Every codec
+// inflates the same stream (zlib's), and the reported size is the compressed size, so the ratios can be compared too
+void codec_deflate(benchmark::State &st, const Codec *codec) {
+    const BenchData &data = bench_data();
+    string outp;
+    for (auto _ : st) {
+        codec->deflate(data.order_file.data(), data.order_file.size(), outp, DEFLATE_LEVEL);
+        benchmark::DoNotOptimize(outp.data());
+    }
+    st.SetBytesProcessed(st.iterations() * data.order_file.size());
+    st.counters["ratio"] = static_cast<double>(data.order_file.size()) / max<size_t>(1, outp.size());
+}
+
+void codec_inflate(benchmark::State &st, const Codec *codec) {
+    const BenchData &data = bench_data();
+    static const string deflated = [&] {
+        string outp;
+        Codec::find("zlib")->deflate(data.order_file.data(), data.order_file.size(), outp, DEFLATE_LEVEL);
+        return outp;
+    }();
+    string outp(data.order_file.size(), '\0');
+    for (auto _ : st) {
+        if (!codec->inflate(deflated.data(), deflated.size(), outp)) st.SkipWithError("inflate failed");
+        benchmark::DoNotOptimize(outp.data());
+    }
+    st.SetBytesProcessed(st.iterations() * data.order_file.size());
+}
+
+/****************************************************************************************************************
+* Entry point (int main)
+****************************************************************************************************************/
+// Entry point for the benchmarks.  Anything left over after the benchmark flags is taken as the order file to use
+int main(int argc, char *argv[]) {
+    benchmark::Initialize(&argc, argv);
+    if (argc > 1) bench_order_path = argv[argc - 1];
+    for (const Codec *it : Codec::available()) {
+        benchmark::RegisterBenchmark((string("deflate/") + it->name()).c_str(), codec_deflate, it)->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark((string("inflate/") + it->name()).c_str(), codec_inflate, it)->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    filesystem::remove_all(filesystem::temp_directory_path() / "icd10_bench");
+    return 0;
+}
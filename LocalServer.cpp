@@ -0,0 +1,139 @@
+#include "LocalServer.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+LocalServer::LocalServer() {
+#ifdef _WIN32
+	WSADATA data;
+	started = !WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+LocalServer::~LocalServer() {
+	close_client();
+	if (server != NO_SOCKET) {
+		close_handle(server);
+		error_code ec;
+		filesystem::remove(socket_path, ec);
+	}
+#ifdef _WIN32
+	if (started) WSACleanup();
+#endif
+}
+
+void LocalServer::close_handle(Handle &handle) {
+	if (handle == NO_SOCKET) return;
+#ifdef _WIN32
+	closesocket(handle);
+#else
+	close(handle);
+#endif
+	handle = NO_SOCKET;
+}
+
+void LocalServer::fail(const char *what) {
+#ifdef _WIN32
+	err = string(what) + " failed (" + to_string(WSAGetLastError()) + ")";
+#else
+	err = string(what) + " failed: " + strerror(errno);
+#endif
+}
+
+bool LocalServer::listen(const string &path) {
+	sockaddr_un addr {};
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		err = "Socket path must be 1 to " + to_string(sizeof(addr.sun_path) - 1) + " characters";
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server == NO_SOCKET) {
+		fail("socket");
+		return false;
+	}
+	// A socket file left behind by a daemon that didn't shut down cleanly would make bind fail
+	error_code ec;
+	filesystem::remove(path, ec);
+	if (::bind(server, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || ::listen(server, 8)) {
+		fail("bind");
+		close_handle(server);
+		return false;
+	}
+	socket_path = path;
+	return true;
+}
+
+bool LocalServer::accept() {
+	close_client();
+	while (true) {
+		client = ::accept(server, nullptr, nullptr);
+		if (client != NO_SOCKET) return true;
+#ifndef _WIN32
+		if (errno == EINTR) continue;
+#endif
+		fail("accept");
+		return false;
+	}
+}
+
+bool LocalServer::read_line(string &line) {
+	while (true) {
+		size_t end = buffer.find('\n');
+		if (end != string::npos) {
+			line.assign(buffer, 0, end);
+			buffer.erase(0, end + 1);
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			return true;
+		}
+		char chunk[4096];
+		const int received = static_cast<int>(recv(client, chunk, sizeof(chunk), 0));
+		if (received <= 0) {
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR) continue;
+#endif
+			return false;
+		}
+		buffer.append(chunk, received);
+	}
+}
+
+bool LocalServer::write_line(const string &line) {
+	const string data = line + '\n';
+	size_t sent = 0;
+	while (sent < data.size()) {
+#ifdef MSG_NOSIGNAL
+		// A client that hung up shouldn't take the daemon down with SIGPIPE
+		const int res = static_cast<int>(send(client, data.data() + sent, static_cast<int>(data.size() - sent), MSG_NOSIGNAL));
+#else
+		const int res = static_cast<int>(send(client, data.data() + sent, static_cast<int>(data.size() - sent), 0));
+#endif
+		if (res <= 0) {
+#ifndef _WIN32
+			if (res < 0 && errno == EINTR) continue;
+#endif
+			return false;
+		}
+		sent += res;
+	}
+	return true;
+}
+
+void LocalServer::close_client() {
+	close_handle(client);
+	buffer.clear();
+}
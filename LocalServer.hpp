@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Line-based server on a local (Unix domain) socket.  Windows 10 and later have AF_UNIX too, through Winsock, so the same
+// socket path works everywhere.  One client is served at a time: accept waits for a client, read_line and write_line talk
+// to it, and close_client hangs up.
+class LocalServer {
+public: // API methods and constructors should be public
+	LocalServer();
+	~LocalServer();
+	LocalServer(const LocalServer &) = delete;
+	LocalServer &operator=(const LocalServer &) = delete;
+	bool listen(const std::string &path); // Any stale socket file left at path is replaced
+	bool accept();
+	bool read_line(std::string &line); // False once the client has hung up
+	bool write_line(const std::string &line);
+	void close_client();
+	const std::string &error() const { return err; }
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+#ifdef _WIN32
+	using Handle = uintptr_t; // SOCKET, without dragging Winsock into every file that includes this
+	static constexpr Handle NO_SOCKET = ~static_cast<Handle>(0); // INVALID_SOCKET
+	bool started = false;
+#else
+	using Handle = int;
+	static constexpr Handle NO_SOCKET = -1;
+#endif
+	Handle server = NO_SOCKET;
+	Handle client = NO_SOCKET;
+	std::string socket_path;
+	std::string buffer; // Bytes received from the client past the last full line
+	std::string err;
+	void fail(const char *what);
+	static void close_handle(Handle &handle);
+};
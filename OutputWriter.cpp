@@ -0,0 +1,470 @@
+#include "OutputWriter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ICD10_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+	constexpr size_t DIRECT_ALIGN = 4096; // O_DIRECT wants the buffer, offset and length aligned to the block size
+	constexpr size_t DIRECT_MIN = 1 << 20; // Below this O_DIRECT saves nothing worth the copy
+	constexpr size_t MAX_WRITE = 1 << 30; // Largest single write request; sqe lengths are 32 bit
+	constexpr unsigned int RING_ENTRIES = 16;
+	constexpr char TEMP_SUFFIX[] = ".tmp"; // Ends a file's temp name while it's being written
+	constexpr int TEMP_TRIES = 16; // Temp names tried for one file before giving up
+
+	// Counts temp files across every writer in the process
+	atomic<uint64_t> temp_count {0};
+
+	// A temp name next to path that no other writer, in this process or another, will pick: "<path>.<pid>.<n>.tmp".
+	// It could still be one left behind by a crashed run, so it's opened exclusively, and another is picked if it's taken
+	string temp_name(const string &path) {
+#ifdef _WIN32
+		const int pid = _getpid();
+#else
+		const pid_t pid = getpid();
+#endif
+		return path + "." + to_string(pid) + "." + to_string(temp_count.fetch_add(1, memory_order_relaxed)) + TEMP_SUFFIX;
+	}
+}
+
+#ifdef ICD10_HAVE_IO_URING
+/*
+* Just enough of io_uring to submit writes and fsyncs and reap their completions, straight on top of the system calls so
+* there's no liburing dependency.  Constructing one fails quietly (valid() is false) when the kernel doesn't have io_uring
+* or it's been disabled, which is the signal to fall back to pwrite.
+*/
+struct OutputWriter::Ring {
+	Ring() {
+		io_uring_params params {};
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+		if (fd < 0) return;
+		sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) sq_len = cq_len = max(sq_len, cq_len);
+		sq = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq == MAP_FAILED) {
+			release();
+			return;
+		}
+		cq = single ? sq : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			release();
+			return;
+		}
+		sqe_len = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED) {
+			release();
+			return;
+		}
+		char *sq_base = static_cast<char *>(sq), *cq_base = static_cast<char *>(cq);
+		sq_tail = reinterpret_cast<unsigned int *>(sq_base + params.sq_off.tail);
+		sq_mask = *reinterpret_cast<unsigned int *>(sq_base + params.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned int *>(sq_base + params.sq_off.array);
+		cq_head = reinterpret_cast<unsigned int *>(cq_base + params.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned int *>(cq_base + params.cq_off.tail);
+		cq_mask = *reinterpret_cast<unsigned int *>(cq_base + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(cq_base + params.cq_off.cqes);
+		capacity = params.sq_entries;
+	}
+	~Ring() { release(); }
+	Ring(const Ring &) = delete;
+	Ring &operator=(const Ring &) = delete;
+	bool valid() const { return fd >= 0 && sqes && sqes != MAP_FAILED; }
+	unsigned int entries() const { return capacity; }
+	// Queue a write; it isn't sent to the kernel until submit
+	void write(int file, const char *buf, size_t len, uint64_t offset, uint64_t tag) {
+		io_uring_sqe &sqe = next_sqe();
+		sqe.opcode = IORING_OP_WRITE;
+		sqe.fd = file;
+		sqe.addr = reinterpret_cast<uint64_t>(buf);
+		sqe.len = static_cast<uint32_t>(len);
+		sqe.off = offset;
+		sqe.user_data = tag;
+		push();
+	}
+	// Queue an fdatasync; it isn't sent to the kernel until submit
+	void datasync(int file, uint64_t tag) {
+		io_uring_sqe &sqe = next_sqe();
+		sqe.opcode = IORING_OP_FSYNC;
+		sqe.fd = file;
+		sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe.user_data = tag;
+		push();
+	}
+	// Send everything queued and wait for at least wait_for completions.  Returns false if the kernel refused
+	bool submit(unsigned int wait_for) {
+		while (true) {
+			int res = static_cast<int>(syscall(__NR_io_uring_enter, fd, queued, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+			if (res >= 0) {
+				queued -= min<unsigned int>(queued, static_cast<unsigned int>(res));
+				return true;
+			}
+			if (errno != EINTR) return false;
+		}
+	}
+	// Pop one completion if there is one
+	bool reap(uint64_t &tag, int &res) {
+		const unsigned int head = *cq_head;
+		if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+		const io_uring_cqe &cqe = cqes[head & cq_mask];
+		tag = cqe.user_data;
+		res = cqe.res;
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+private: // Nothing else needs to see these
+	int fd = -1;
+	void *sq = MAP_FAILED, *cq = MAP_FAILED;
+	size_t sq_len = 0, cq_len = 0, sqe_len = 0;
+	io_uring_sqe *sqes = nullptr;
+	unsigned int *sq_tail = nullptr, *sq_array = nullptr, *cq_head = nullptr, *cq_tail = nullptr;
+	unsigned int sq_mask = 0, cq_mask = 0, capacity = 0, queued = 0;
+	io_uring_cqe *cqes = nullptr;
+	io_uring_sqe &next_sqe() {
+		io_uring_sqe &sqe = sqes[*sq_tail & sq_mask];
+		memset(&sqe, 0, sizeof(sqe));
+		return sqe;
+	}
+	void push() {
+		const unsigned int tail = *sq_tail;
+		sq_array[tail & sq_mask] = tail & sq_mask;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		queued++;
+	}
+	void release() {
+		if (sqes && sqes != MAP_FAILED) munmap(sqes, sqe_len);
+		if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_len);
+		if (sq != MAP_FAILED) munmap(sq, sq_len);
+		sqes = nullptr;
+		sq = cq = MAP_FAILED;
+		if (fd >= 0) close(fd);
+		fd = -1;
+	}
+};
+#else
+// No io_uring here, so there's never a valid ring
+struct OutputWriter::Ring {
+	bool valid() const { return false; }
+};
+#endif
+
+OutputWriter::OutputWriter(bool direct_io) : direct(direct_io) {}
+
+void OutputWriter::add(string path, string data) {
+	lock_guard<mutex> guard(lock);
+	jobs.push_back(Job());
+	jobs.back().path = move(path);
+	jobs.back().data = move(data);
+}
+
+void OutputWriter::add_ref(string path, const string &data) {
+	lock_guard<mutex> guard(lock);
+	jobs.push_back(Job());
+	jobs.back().path = move(path);
+	jobs.back().ref = &data;
+}
+
+bool OutputWriter::flush() {
+	stage();
+	return publish();
+}
+
+bool OutputWriter::stage() {
+	vector<Job> batch;
+	{
+		lock_guard<mutex> guard(lock);
+		batch.swap(jobs);
+	}
+	if (batch.empty()) return true;
+	for (Job &it : batch) {
+		it.temp_path = temp_name(it.path);
+		it.length = it.write_len = it.ref ? it.ref->size() : it.data.size();
+	}
+#ifdef _WIN32
+	used = "stdio";
+	for (Job &it : batch) write_stdio(it);
+#else
+	// A job that can't be opened is left with no fd and an error, and is reported by rename_batch
+	for (Job &it : batch) open_job(it);
+	used = "pwrite";
+	Ring ring;
+	bool synced = false;
+#ifdef ICD10_HAVE_IO_URING
+	if (ring.valid() && write_uring(batch, ring)) used = "io_uring";
+#endif
+	// Finish anything io_uring didn't (all of it, without a ring), then trim the O_DIRECT padding back off
+	for (Job &it : batch) {
+		write_pwrite(it);
+		if (it.fd >= 0 && it.aligned && !it.error && ftruncate(it.fd, it.length)) it.error = errno;
+	}
+#ifdef ICD10_HAVE_IO_URING
+	if (ring.valid()) synced = sync_uring(batch, ring);
+#endif
+	if (!synced) sync_fallback(batch);
+	for (Job &it : batch) {
+		if (it.fd >= 0 && close(it.fd) && !it.error) it.error = errno;
+		it.fd = -1;
+	}
+#endif
+	bool written = true;
+	for (Job &it : batch) {
+		if (it.error) written = false;
+		// It's all on disk now, so the buffers can go while the files wait to be published
+		string().swap(it.data);
+		it.aligned.reset();
+		it.ref = nullptr;
+		staged.push_back(move(it));
+	}
+	return written;
+}
+
+bool OutputWriter::publish() {
+	vector<Job> batch;
+	batch.swap(staged);
+	failures.clear();
+	return rename_batch(batch);
+}
+
+void OutputWriter::discard() {
+	for (Job &it : staged) {
+		error_code ec;
+		filesystem::remove(it.temp_path, ec);
+	}
+	staged.clear();
+}
+
+bool OutputWriter::rename_batch(vector<Job> &batch) {
+	// Everything that was written is on disk now, so renaming can't expose a partial file.  A failed file is never
+	// renamed, so whatever was at its final name before is still there
+	set<filesystem::path> dirs;
+	for (Job &it : batch) {
+		error_code ec;
+		if (!it.error) {
+			filesystem::rename(it.temp_path, it.path, ec);
+			if (!ec) {
+				written_bytes += it.length;
+				dirs.insert(filesystem::path(it.path).parent_path());
+				continue;
+			}
+		}
+		filesystem::remove(it.temp_path, ec);
+		failures.push_back(it.path);
+	}
+#ifndef _WIN32
+	// The renames only live in the directories until those are synced too.  Once per directory, not once per file
+	for (const filesystem::path &it : dirs) {
+		int fd = open(it.empty() ? "." : it.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) continue;
+		fsync(fd);
+		close(fd);
+	}
+#endif
+	return failures.empty();
+}
+
+#ifdef _WIN32
+bool OutputWriter::write_stdio(Job &job) {
+	FILE *file = nullptr;
+	// "x" fails rather than open a temp file that's already there
+	for (int tries = 0; tries < TEMP_TRIES && (fopen_s(&file, job.temp_path.c_str(), "wbx") || !file); tries++) {
+		file = nullptr;
+		job.temp_path = temp_name(job.path);
+	}
+	if (!file) {
+		job.error = EIO;
+		return false;
+	}
+	if (fwrite(job.bytes(), 1, job.length, file) != job.length) job.error = EIO;
+	// Windows has no batched flush, so each file is committed on its own before anything is published
+	if (!job.error && (fflush(file) || _commit(_fileno(file)))) job.error = EIO;
+	if (fclose(file) && !job.error) job.error = EIO;
+	return !job.error;
+}
+#else
+bool OutputWriter::open_job(Job &job) {
+#ifdef O_DIRECT
+	if (direct && job.length >= DIRECT_MIN) {
+		// O_DIRECT skips the page cache, but only for aligned buffers and lengths.  Write a padded copy and trim the
+		// padding off once it's written.  Not every filesystem supports it (tmpfs doesn't), so fall through if it fails
+		job.fd = open_temp(job, O_DIRECT);
+		if (job.fd >= 0) {
+			const size_t padded = (job.length + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+			char *copy = static_cast<char *>(aligned_alloc(DIRECT_ALIGN, padded));
+			if (copy) {
+				memcpy(copy, job.bytes(), job.length);
+				memset(copy + job.length, 0, padded - job.length);
+				job.aligned.reset(copy);
+				job.write_len = padded;
+				// The copy is what gets written; the original can go
+				string().swap(job.data);
+				return true;
+			}
+			close(job.fd);
+		}
+		// Opened exclusively, so anything at the temp name now is this job's own, created before O_DIRECT was refused
+		if (errno != EEXIST) unlink(job.temp_path.c_str());
+		job.temp_path = temp_name(job.path);
+	}
+#endif
+	job.fd = open_temp(job, 0);
+	if (job.fd < 0) job.error = errno;
+	return job.fd >= 0;
+}
+
+int OutputWriter::open_temp(Job &job, int flags) {
+	// O_EXCL, so two writers can never share a temp file, even if a stale one has the name this one picked
+	for (int tries = 0; tries < TEMP_TRIES; tries++) {
+		const int fd = open(job.temp_path.c_str(), flags | O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (fd >= 0 || errno != EEXIST) return fd;
+		job.temp_path = temp_name(job.path);
+	}
+	errno = EEXIST;
+	return -1;
+}
+
+void OutputWriter::write_pwrite(Job &job) {
+	const char *buf = job.bytes();
+	while (job.fd >= 0 && !job.error && job.written < job.write_len) {
+		ssize_t res = pwrite(job.fd, buf + job.written, min(job.write_len - job.written, MAX_WRITE), job.written);
+		if (res < 0) {
+			if (errno != EINTR) job.error = errno;
+		} else if (res == 0) {
+			job.error = EIO;
+		} else {
+			job.written += res;
+		}
+	}
+}
+
+void OutputWriter::sync_fallback(vector<Job> &batch) {
+	int first = -1;
+	bool one_fs = true;
+	dev_t first_dev {};
+	for (Job &it : batch) {
+		if (it.fd < 0 || it.error) continue;
+		struct stat st {};
+		if (fstat(it.fd, &st)) {
+			one_fs = false;
+		} else if (first < 0) {
+			first = it.fd;
+			first_dev = st.st_dev;
+		} else if (st.st_dev != first_dev) {
+			one_fs = false;
+		}
+	}
+	if (first < 0) return;
+#ifdef __linux__
+	// One syncfs covers every file on the filesystem, rather than one flush per file
+	if (one_fs && batch.size() > 1 && !syncfs(first)) return;
+#else
+	(void)one_fs;
+#endif
+	for (Job &it : batch) {
+		if (it.fd < 0 || it.error) continue;
+#ifdef __APPLE__
+		if (fsync(it.fd)) it.error = errno;
+#else
+		if (fdatasync(it.fd)) it.error = errno;
+#endif
+	}
+}
+
+#ifdef ICD10_HAVE_IO_URING
+bool OutputWriter::write_uring(vector<Job> &batch, Ring &ring) {
+	// Every write in flight is one sqe, tagged with its job's index.  Each job has at most one write in flight, since a
+	// short write has to be resumed from where it stopped
+	size_t next = 0;
+	unsigned int in_flight = 0;
+	const auto queue_job = [&](size_t index) {
+		Job &job = batch[index];
+		ring.write(job.fd, job.bytes() + job.written, min(job.write_len - job.written, MAX_WRITE), job.written, index);
+		in_flight++;
+	};
+	while (true) {
+		while (in_flight < ring.entries() && next < batch.size()) {
+			Job &job = batch[next];
+			if (job.fd >= 0 && !job.error && job.written < job.write_len) queue_job(next);
+			next++;
+		}
+		if (!in_flight) break;
+		if (!ring.submit(1)) return false;
+		uint64_t tag = 0;
+		int res = 0;
+		while (ring.reap(tag, res)) {
+			in_flight--;
+			Job &job = batch[tag];
+			if (res == -EINVAL || res == -EOPNOTSUPP) {
+				// IORING_OP_WRITE needs 5.6; an older kernel sets up the ring but rejects the op.  pwrite picks the job
+				// up afterwards
+				continue;
+			}
+			if (res < 0) {
+				if (res != -EINTR && res != -EAGAIN) job.error = -res;
+			} else if (res == 0) {
+				job.error = EIO;
+			} else {
+				job.written += res;
+			}
+			// Resume a short write from where it stopped
+			if (!job.error && job.written < job.write_len) queue_job(tag);
+		}
+	}
+	return true;
+}
+
+bool OutputWriter::sync_uring(vector<Job> &batch, Ring &ring) {
+	// All the fdatasyncs go to the kernel together, so the device sees one burst of flushes instead of one at a time
+	size_t next = 0;
+	unsigned int in_flight = 0;
+	bool unsupported = false;
+	while (true) {
+		while (in_flight < ring.entries() && next < batch.size()) {
+			Job &job = batch[next];
+			if (job.fd >= 0 && !job.error) {
+				ring.datasync(job.fd, next);
+				in_flight++;
+			}
+			next++;
+		}
+		if (!in_flight) break;
+		if (!ring.submit(1)) return false;
+		uint64_t tag = 0;
+		int res = 0;
+		while (ring.reap(tag, res)) {
+			in_flight--;
+			if (res == -EINVAL || res == -EOPNOTSUPP) {
+				unsupported = true;
+			} else if (res < 0) {
+				batch[tag].error = -res;
+			}
+		}
+	}
+	return !unsupported;
+}
+#endif
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects finished output files and writes them all in one batch.  On Linux the batch is submitted to io_uring when the
+// kernel allows it, with an optional O_DIRECT path for large files, and falls back to pwrite when it doesn't.  Elsewhere
+// the files are written with ordinary C stdio.  add is safe to call from any thread; flush is not.
+//
+// Publication is crash-safe: each file is written to a temp file next to it, named for this process and opened
+// exclusively so two runs writing the same destination never share one.  The whole batch is flushed to disk together
+// (one batched fdatasync through io_uring, or one syncfs when every file is on the same filesystem), and only then is
+// each temp file renamed over its final name.  A crash at any point leaves either the old file or the new one, never a
+// partial one.
+class OutputWriter {
+public: // API methods and constructors should be public
+	explicit OutputWriter(bool direct_io = false);
+	~OutputWriter() { discard(); }
+	OutputWriter(const OutputWriter &) = delete;
+	OutputWriter &operator=(const OutputWriter &) = delete;
+	void add(std::string path, std::string data);
+	void add_ref(std::string path, const std::string &data); // Like add, but data isn't copied; it must outlive flush
+	bool flush(); // stage, then publish
+	bool stage(); // Write and flush everything added, but leave it under the temp names.  False if anything failed
+	bool publish(); // Rename everything staged over its final name
+	void discard(); // Remove everything staged, leaving whatever was at the final names
+	const std::vector<std::string> &failed() const { return failures; } // Paths that couldn't be written by flush
+	const char *backend() const { return used; } // How the last flush wrote its files
+	uint64_t bytes() const { return written_bytes; } // Total bytes written by every flush so far
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	struct Ring;
+	struct Job {
+		std::string path;
+		std::string temp_path;
+		std::string data;
+		const std::string *ref = nullptr; // Set instead of data by add_ref
+		std::unique_ptr<char, decltype(&std::free)> aligned {nullptr, std::free}; // Padded, aligned copy of data for O_DIRECT
+		size_t length = 0; // Length of the file; data is released early on the O_DIRECT path, so it's kept here
+		size_t write_len = 0; // Length being written; length, or the padded length for O_DIRECT
+		size_t written = 0;
+		int fd = -1;
+		int error = 0;
+		const char *bytes() const { return aligned ? aligned.get() : ref ? ref->data() : data.data(); }
+	};
+	std::mutex lock;
+	std::vector<Job> jobs;
+	std::vector<Job> staged; // Written and flushed, waiting for publish or discard
+	std::vector<std::string> failures;
+	bool direct;
+	const char *used = "none";
+	uint64_t written_bytes = 0;
+	bool rename_batch(std::vector<Job> &batch);
+#ifdef _WIN32
+	bool write_stdio(Job &job);
+#else
+	bool open_job(Job &job);
+	int open_temp(Job &job, int flags); // Open a new temp file for job exclusively, renaming job.temp_path until one is free
+	void write_pwrite(Job &job);
+	bool write_uring(std::vector<Job> &batch, Ring &ring);
+	bool sync_uring(std::vector<Job> &batch, Ring &ring);
+	void sync_fallback(std::vector<Job> &batch);
+#endif
+};
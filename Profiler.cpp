@@ -0,0 +1,210 @@
+#include "Profiler.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <iomanip>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#else
+#include <fstream>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+/*
+* Allocation counting.  operator new is replaced program-wide, but it only touches the counters while a Profiler is
+* alive, so without --profile the cost is one relaxed load per allocation.
+*/
+namespace {
+	atomic<bool> counting {false};
+	atomic<uint64_t> alloc_count {0};
+	atomic<uint64_t> alloc_total {0};
+}
+
+void *operator new(size_t size) {
+	if (counting.load(memory_order_relaxed)) {
+		alloc_count.fetch_add(1, memory_order_relaxed);
+		alloc_total.fetch_add(size, memory_order_relaxed);
+	}
+	// malloc(0) may return null; operator new may not
+	if (void *ptr = malloc(size ? size : 1)) return ptr;
+	throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+Profiler::Profiler() : created(chrono::steady_clock::now()) {
+	// Whichever thread creates the profiler is the main thread as far as the trace is concerned
+	threads.push_back({this_thread::get_id(), "main"});
+	alloc_count.store(0, memory_order_relaxed);
+	alloc_total.store(0, memory_order_relaxed);
+	counting.store(true, memory_order_relaxed);
+}
+
+Profiler::~Profiler() {
+	counting.store(false, memory_order_relaxed);
+}
+
+size_t Profiler::begin(const string &name) {
+	size_t index = 0;
+	for (; index < stages.size(); index++) {
+		if (stages[index].name == name) break;
+	}
+	if (index == stages.size()) {
+		stages.push_back(Stage());
+		stages.back().name = name;
+		marks.push_back(Mark());
+	}
+	Mark &mark = marks[index];
+	mark.rss = current_rss();
+	mark.allocs = alloc_count.load(memory_order_relaxed);
+	mark.alloc_bytes = alloc_total.load(memory_order_relaxed);
+	// Take the time last so the bookkeeping above isn't counted against the stage
+	mark.time = chrono::steady_clock::now();
+	if (!stages[index].runs) stages[index].start_ms = chrono::duration<double, milli>(mark.time - created).count();
+	return index;
+}
+
+void Profiler::end(size_t index, uint64_t bytes_in, uint64_t bytes_out) {
+	// Take the time first, for the same reason as in begin
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	const Mark &mark = marks[index];
+	Stage &stage = stages[index];
+	stage.elapsed_ms += chrono::duration<double, milli>(now - mark.time).count();
+	stage.allocs += alloc_count.load(memory_order_relaxed) - mark.allocs;
+	stage.alloc_bytes += alloc_total.load(memory_order_relaxed) - mark.alloc_bytes;
+	stage.rss_delta += static_cast<int64_t>(current_rss()) - static_cast<int64_t>(mark.rss);
+	stage.bytes_in += bytes_in;
+	stage.bytes_out += bytes_out;
+	stage.runs++;
+	trace(stage.name, mark.time, now);
+}
+
+size_t Profiler::thread_index() {
+	thread::id id = this_thread::get_id();
+	// Search from the back: ids get reused once a thread is joined, and the newest entry is the live thread
+	for (size_t i = threads.size(); i-- > 0;) {
+		if (threads[i].first == id) return i;
+	}
+	threads.push_back({id, "thread " + to_string(threads.size())});
+	return threads.size() - 1;
+}
+
+void Profiler::trace(const string &name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point finish) {
+	TraceEvent event;
+	event.name = name;
+	event.ts_us = chrono::duration<double, micro>(start - created).count();
+	event.dur_us = chrono::duration<double, micro>(finish - start).count();
+	lock_guard<mutex> lock(trace_lock);
+	event.tid = thread_index();
+	events.push_back(move(event));
+}
+
+void Profiler::name_thread(const string &name) {
+	// Always start a new track, so a new worker that happens to get a finished worker's id doesn't share its row
+	lock_guard<mutex> lock(trace_lock);
+	threads.push_back({this_thread::get_id(), name});
+}
+
+void Profiler::report_table(ostream &out) const {
+	out << endl << left << setw(12) << "Stage" << right << setw(12) << "Start (ms)" << setw(12) << "Time (ms)" << setw(14) << "Bytes in"
+		<< setw(14) << "Bytes out" << setw(10) << "Allocs" << setw(14) << "Alloc bytes" << setw(14) << "RSS delta" << endl;
+	out << string(102, '-') << endl;
+	out << fixed << setprecision(2);
+	for (const Stage &it : stages) {
+		out << left << setw(12) << it.name << right << setw(12) << it.start_ms << setw(12) << it.elapsed_ms << setw(14) << it.bytes_in
+			<< setw(14) << it.bytes_out << setw(10) << it.allocs << setw(14) << it.alloc_bytes << setw(14) << it.rss_delta << endl;
+	}
+	out << string(102, '-') << endl;
+	out << "Total " << chrono::duration<double, milli>(chrono::steady_clock::now() - created).count() << " ms, peak RSS " << peak_rss() << " bytes" << endl;
+	out << defaultfloat;
+}
+
+void Profiler::report_json(ostream &out) const {
+	// Stage names are fixed identifiers, so there's nothing to escape
+	out << fixed << setprecision(3);
+	out << "{\"total_ms\":" << chrono::duration<double, milli>(chrono::steady_clock::now() - created).count() << ",\"peak_rss\":" << peak_rss() << ",\"stages\":[";
+	for (size_t i = 0; i < stages.size(); i++) {
+		const Stage &it = stages[i];
+		if (i) out << ',';
+		out << "{\"name\":\"" << it.name << "\",\"start_ms\":" << it.start_ms << ",\"elapsed_ms\":" << it.elapsed_ms << ",\"runs\":" << it.runs
+			<< ",\"bytes_in\":" << it.bytes_in << ",\"bytes_out\":" << it.bytes_out << ",\"allocs\":" << it.allocs
+			<< ",\"alloc_bytes\":" << it.alloc_bytes << ",\"rss_delta\":" << it.rss_delta << '}';
+	}
+	out << "]}" << endl;
+	out << defaultfloat;
+}
+
+void Profiler::report_trace(ostream &out) {
+	// Complete ("X") events for the spans, plus metadata ("M") events so each thread shows up by name
+	lock_guard<mutex> lock(trace_lock);
+	out << fixed << setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (size_t i = 0; i < threads.size(); i++) {
+		if (i) out << ',';
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << threads[i].second << "\"}}";
+	}
+	for (const TraceEvent &it : events) {
+		out << ",{\"name\":\"" << it.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << it.tid << ",\"ts\":" << it.ts_us << ",\"dur\":" << it.dur_us << '}';
+	}
+	out << "]}" << endl;
+	out << defaultfloat;
+}
+
+uint64_t Profiler::current_rss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters {};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	// Second field of statm is resident pages
+	ifstream statm("/proc/self/statm");
+	uint64_t pages = 0, resident = 0;
+	if (!(statm >> pages >> resident)) return 0;
+	return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+uint64_t Profiler::peak_rss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters {};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage {};
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+	// ru_maxrss is in KiB on Linux
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+ProfileStage::ProfileStage(Profiler *profiler, const char *name) : prof(profiler) {
+	if (prof) index = prof->begin(name);
+}
+
+ProfileStage::~ProfileStage() {
+	if (prof) prof->end(index, bytes_in, bytes_out);
+}
+
+TraceSpan::TraceSpan(Profiler *profiler, const char *name, const char *thread_name) : prof(profiler), span_name(name) {
+	if (!prof) return;
+	if (thread_name) prof->name_thread(thread_name);
+	start = chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan() {
+	if (prof) prof->trace(span_name, start, chrono::steady_clock::now());
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Per-stage wall time, bytes, allocations and RSS.  A stage that runs more than once (discovery fetches two pages, for
+// instance) accumulates into the same row.  Every stage and every TraceSpan is also kept as a trace event, so the run can
+// be exported in Chrome's trace event format and viewed in Perfetto or chrome://tracing.
+class Profiler {
+public: // API methods and constructors should be public
+	struct Stage {
+		std::string name;
+		double start_ms = 0; // Monotonic start of the first run, relative to when the profiler was created
+		double elapsed_ms = 0;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+		uint64_t allocs = 0;
+		uint64_t alloc_bytes = 0;
+		int64_t rss_delta = 0;
+		unsigned int runs = 0;
+	};
+	Profiler();
+	~Profiler();
+	size_t begin(const std::string &name);
+	void end(size_t index, uint64_t bytes_in, uint64_t bytes_out);
+	void report_table(std::ostream &out) const;
+	void report_json(std::ostream &out) const;
+	void report_trace(std::ostream &out);
+	void trace(const std::string &name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point finish);
+	void name_thread(const std::string &name);
+	static uint64_t current_rss();
+	static uint64_t peak_rss();
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	struct Mark {
+		std::chrono::steady_clock::time_point time;
+		uint64_t allocs = 0;
+		uint64_t alloc_bytes = 0;
+		uint64_t rss = 0;
+	};
+	struct TraceEvent {
+		std::string name;
+		size_t tid = 0;
+		double ts_us = 0;
+		double dur_us = 0;
+	};
+	std::chrono::steady_clock::time_point created;
+	std::vector<Stage> stages;
+	std::vector<Mark> marks;
+	// Trace events come from worker threads as well as the main thread, so everything below is guarded by trace_lock
+	std::mutex trace_lock;
+	std::vector<TraceEvent> events;
+	std::vector<std::pair<std::thread::id, std::string>> threads;
+	size_t thread_index(); // Must be called with trace_lock held
+};
+
+// Scoped stage for a Profiler that may be null.  With no profiler it does nothing, which is what keeps --profile free
+// when it isn't given
+class ProfileStage {
+public: // API methods and constructors should be public
+	ProfileStage(Profiler *profiler, const char *name);
+	~ProfileStage();
+	ProfileStage(const ProfileStage &) = delete;
+	ProfileStage &operator=(const ProfileStage &) = delete;
+	void bytes(uint64_t in, uint64_t out) { bytes_in = in; bytes_out = out; }
+private: // Nothing else needs to see these
+	Profiler *prof;
+	size_t index = 0;
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+};
+
+// Scoped trace span for a Profiler that may be null.  Unlike ProfileStage it's safe to use from any thread.  If
+// thread_name is given, the calling thread is labelled with it in the trace
+class TraceSpan {
+public: // API methods and constructors should be public
+	TraceSpan(Profiler *profiler, const char *name, const char *thread_name = nullptr);
+	~TraceSpan();
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+private: // Nothing else needs to see these
+	Profiler *prof;
+	const char *span_name;
+	std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,101 @@
+#include "Progress.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+	bool stdout_is_terminal() {
+#ifdef _WIN32
+		return _isatty(_fileno(stdout)) != 0;
+#else
+		return isatty(fileno(stdout)) != 0;
+#endif
+	}
+
+	void append_bytes(ostringstream &out, uint64_t bytes) {
+		if (bytes < 1024 * 1024) out << (bytes + 1023) / 1024 << " KiB";
+		else out << fixed << setprecision(1) << bytes / (1024.0 * 1024.0) << " MiB";
+	}
+}
+
+Progress::Progress(ostream &out, chrono::milliseconds interval) : os(out), tick(interval), terminal(&out == &cout && stdout_is_terminal()) {
+	reporter = thread(&Progress::run, this);
+}
+
+Progress::~Progress() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	reporter.join();
+	// Leave the console as if there had never been a status line
+	clear_line();
+	os.flush();
+}
+
+void Progress::reset() {
+	for (atomic<uint64_t> &it : counters) it.store(0, memory_order_relaxed);
+}
+
+void Progress::message(const string &text) {
+	lock_guard<mutex> guard(lock);
+	clear_line();
+	os << text << '\n';
+	dirty = true;
+}
+
+void Progress::run() {
+	unique_lock<mutex> guard(lock);
+	while (!wake.wait_for(guard, tick, [this] { return stopping; })) {
+		if (terminal) {
+			const string status = render();
+			if (status != shown) {
+				clear_line();
+				os << status;
+				shown = status;
+				dirty = true;
+			}
+		}
+		if (dirty) {
+			os.flush();
+			dirty = false;
+		}
+	}
+}
+
+string Progress::render() const {
+	const uint64_t down = counters[downloaded].load(memory_order_relaxed);
+	const uint64_t down_size = counters[download_size].load(memory_order_relaxed);
+	const uint64_t recs = counters[records].load(memory_order_relaxed);
+	const uint64_t comp = counters[compressed].load(memory_order_relaxed);
+	ostringstream out;
+	if (down) {
+		out << "  Downloaded ";
+		append_bytes(out, down);
+		if (down_size) out << " (" << min<uint64_t>(down * 100 / down_size, 100) << "%)";
+	}
+	if (recs) out << "  " << recs << " records";
+	if (comp) {
+		out << "  Compressed ";
+		append_bytes(out, comp);
+	}
+	return out.str();
+}
+
+void Progress::clear_line() {
+	if (shown.empty()) return;
+	os << '\r' << string(shown.size(), ' ') << '\r';
+	shown.clear();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Progress counters that any thread can bump, and one reporter thread that renders them as a single status line.  A bump
+// is one relaxed atomic add, so workers never wait on the console.  Status messages are written without flushing, and the
+// reporter flushes at most once per interval, so a whole run only flushes stdout a handful of times.  cerr is tied to
+// cout, so an error still comes out after the messages before it.  The status line is only drawn on a terminal; anywhere
+// else only the messages are written.
+class Progress {
+public: // API methods and constructors should be public
+	enum Counter : int {
+		downloaded, // Bytes of the zip file received so far
+		download_size, // Bytes of the zip file expected, if the server said
+		records, // .go file records generated
+		compressed, // .go file bytes deflated
+		num_counters
+	};
+	explicit Progress(std::ostream &out, std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+	~Progress();
+	Progress(const Progress &) = delete;
+	Progress &operator=(const Progress &) = delete;
+	void add(Counter which, uint64_t n) { counters[which].fetch_add(n, std::memory_order_relaxed); }
+	void set(Counter which, uint64_t n) { counters[which].store(n, std::memory_order_relaxed); }
+	void reset(); // Zero every counter, for the next run in daemon or watch mode
+	void message(const std::string &text); // Write a line above the status line
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	std::ostream &os;
+	const std::chrono::milliseconds tick;
+	const bool terminal;
+	std::atomic<uint64_t> counters[num_counters] {};
+	// Everything below is guarded by lock
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+	bool dirty = false; // Written since the last flush
+	std::string shown; // The status line on screen, if any
+	std::thread reporter;
+	void run();
+	std::string render() const;
+	void clear_line(); // Must be called with lock held
+};
@@ -0,0 +1,184 @@
+"""
+Local stand-in for the parts of cms.gov the ICD-10 program reads, so the tests can drive it offline.  It serves the
+ICD-10 menu, the release pages it links to, and the tabular order zips those link to.  Every response carries an ETag
+and a Last-Modified, and conditional requests that match are answered with a 304.  Range requests for a zip are
+ignored unless ranges says otherwise.  Every request is logged.  The tests change what's served between checks by
+assigning to menu, pages, zips and ranges.
+"""
+import email.utils
+import hashlib
+import http.server
+import io
+import os.path
+import re
+import struct
+import threading
+import time
+import zipfile
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+# The program under test.  Set ICD10_EXE to test another build
+PROGRAM = os.environ.get('ICD10_EXE', os.path.join(ROOT, 'x64', 'Release', 'ICD10.exe'))
+MENU_PATH = '/medicare/coding/icd10'
+ORDER_FILE = os.path.join(ROOT, 'Benchmark', 'icd10cm_order_2099.txt')
+
+
+def release_path(year, suffix=''):
+    """
+    The path of a release page on the menu.
+    """
+    return f'{MENU_PATH}/{year}-icd-10-cm{suffix}'
+
+
+def zip_path(year, folder='zip'):
+    """
+    The path of a release's tabular order zip.
+    """
+    return f'/files/{folder}/{year}-code-descriptions-tabular-order.zip'
+
+
+def make_zip(year, extra=b'', comment=b''):
+    """
+    A tabular order zip for year, holding the checked-in synthetic order file under the release's name.  extra is
+    stored as a second entry, so two zips for the same year can be told apart.  comment is the archive comment.
+    """
+    with open(ORDER_FILE, 'rb') as order:
+        data = order.read()
+    buf = io.BytesIO()
+    with zipfile.ZipFile(buf, 'w', zipfile.ZIP_DEFLATED) as archive:
+        archive.writestr(f'icd10cm_order_{year}.txt', data)
+        if extra:
+            archive.writestr('readme.txt', extra)
+        archive.comment = comment
+    return buf.getvalue()
+
+
+def make_zip64(data):
+    """
+    The zip data (with no comment) turned into a zip64 archive: its end of central directory record points at a zip64
+    one through a locator, the way archives too big for the plain record are written.
+    """
+    eocd = len(data) - 22
+    entries, central_size, central = struct.unpack_from('<HII', data, eocd + 10)
+    record = struct.pack('<IQHHIIQQQQ', 0x06064b50, 44, 45, 45, 0, 0, entries, entries, central_size, central)
+    locator = struct.pack('<IIQI', 0x07064b50, 0, eocd, 1)
+    end = struct.pack('<IHHHHIIH', 0x06054b50, 0, 0, 0xffff, 0xffff, central_size, 0xffffffff, 0)
+    return data[:eocd] + record + locator + end
+
+
+class StandIn:
+    """
+    The stand-in server.  menu is the (href, text) of the one link on the menu; pages maps a release page's path to the
+    zip link on it; zips maps a zip's path to its bytes.  ranges is how a zip's range requests are answered: 'ignore'
+    (with the whole zip), 'honor', or 'unknown' (honored, but with a Content-Range that doesn't give the size).
+    requests is every request so far, as (method, path, status).
+    """
+
+    def __init__(self):
+        self.menu = (release_path(2027), '2027 ICD-10-CM')
+        self.pages = {release_path(2027): zip_path(2027)}
+        self.zips = {zip_path(2027): make_zip(2027)}
+        self.ranges = 'ignore'
+        self.requests = []
+        self.lock = threading.Lock()
+        self.stamps = {}
+        self.server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), self._handler())
+        self.thread = threading.Thread(target=self.server.serve_forever, daemon=True)
+
+    def __enter__(self):
+        self.thread.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.server.shutdown()
+        self.server.server_close()
+
+    @property
+    def menu_url(self):
+        """
+        What to pass to the program with /u.
+        """
+        return f'http://127.0.0.1:{self.server.server_address[1]}{MENU_PATH}'
+
+    def count(self, method, path, status=None):
+        """
+        How many requests so far were for path with method (and answered with status, if it's given).
+        """
+        with self.lock:
+            return sum(1 for it in self.requests if it[0] == method and it[1] == path and status in (None, it[2]))
+
+    def body(self, path):
+        """
+        What's served at path right now, or None for a 404.
+        """
+        if path == MENU_PATH:
+            href, text = self.menu
+            return f'<ul class="menu"><li><a href="{href}">{text}</a></li></ul>'.encode()
+        if path in self.pages:
+            return f'<li><a href="{self.pages[path]}">Code Descriptions in Tabular Order (ZIP)</a></li>'.encode()
+        return self.zips.get(path)
+
+    def validators(self, path, body):
+        """
+        The ETag and Last-Modified for body at path.  The Last-Modified is when path last started serving this body.
+        """
+        etag = '"' + hashlib.sha1(body).hexdigest()[:16] + '"'
+        with self.lock:
+            if self.stamps.get(path, (None,))[0] != etag:
+                self.stamps[path] = (etag, email.utils.formatdate(time.time(), usegmt=True))
+            return self.stamps[path]
+
+    def _handler(self):
+        standin = self
+
+        class Handler(http.server.BaseHTTPRequestHandler):
+            protocol_version = 'HTTP/1.1'
+
+            def respond(self, head):
+                path = self.path
+                body = standin.body(path)
+                if body is None:
+                    self.reply(path, 404, {}, b'', head)
+                    return
+                etag, modified = standin.validators(path, body)
+                headers = {'ETag': etag, 'Last-Modified': modified}
+                match = self.headers.get('If-None-Match')
+                since = self.headers.get('If-Modified-Since')
+                if (match is not None and match == etag) or (match is None and since is not None and since == modified):
+                    self.reply(path, 304, headers, b'', head)
+                    return
+                wanted = re.fullmatch(r'bytes=(\d*)-(\d*)', self.headers.get('Range', ''))
+                if wanted and path in standin.zips and standin.ranges != 'ignore':
+                    first, last = wanted.groups()
+                    if not first:
+                        first, last = max(len(body) - int(last), 0), len(body) - 1
+                    else:
+                        first, last = int(first), min(int(last or len(body) - 1), len(body) - 1)
+                    size = '*' if standin.ranges == 'unknown' else str(len(body))
+                    headers['Content-Range'] = f'bytes {first}-{last}/{size}'
+                    self.reply(path, 206, headers, body[first:last + 1], head)
+                    return
+                self.reply(path, 200, headers, body, head)
+
+            def reply(self, path, status, headers, body, head):
+                with standin.lock:
+                    standin.requests.append((self.command, path, status))
+                self.send_response(status)
+                for key, value in headers.items():
+                    self.send_header(key, value)
+                if status != 304:
+                    self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                if not head and status != 304:
+                    self.wfile.write(body)
+
+            def do_GET(self):
+                self.respond(False)
+
+            def do_HEAD(self):
+                self.respond(True)
+
+            def log_message(self, *args):
+                pass
+
+        return Handler
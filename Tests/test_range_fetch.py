@@ -0,0 +1,93 @@
+"""
+Tests for fetching only the order file out of the tabular order zip with range requests, against the local stand-in: a
+server that honors them is asked for the end of the zip, its central directory and the one entry; one that ignores them
+sends the whole zip on the first request; and a zip64 archive or an unusable answer falls back to a plain download.
+"""
+import io
+import os
+import os.path
+import subprocess
+import tempfile
+import unittest
+import zipfile
+
+from standin import PROGRAM, StandIn, make_zip, make_zip64, zip_path
+
+OUTPUT = 'Combined version - Filename_Base_2027.zip'
+BUNDLE = '2027-code-descriptions-tabular-order.zip'
+REBUILT = 'icd10cm_order_2027.zip'
+
+
+class RangeFetchTest(unittest.TestCase):
+    """
+    Each test serves a zip from a fresh stand-in, runs the program once against it, and checks what it asked for and
+    what it saved.
+    """
+
+    def setUp(self):
+        self.standin = StandIn().__enter__()
+        self.addCleanup(self.standin.__exit__)
+        self.dest = tempfile.TemporaryDirectory()
+        self.addCleanup(self.dest.cleanup)
+
+    def run_program(self):
+        with open(os.path.join(self.dest.name, 'run.log'), 'w') as log:
+            code = subprocess.call([PROGRAM, '/u', self.standin.menu_url, '/p', self.dest.name],
+                                   stdout=log, stderr=subprocess.STDOUT, timeout=120)
+        self.assertEqual(code, 0)
+        self.assertTrue(os.path.exists(os.path.join(self.dest.name, OUTPUT)))
+
+    def saved(self, name):
+        path = os.path.join(self.dest.name, name)
+        if not os.path.exists(path):
+            return None
+        with open(path, 'rb') as saved:
+            return saved.read()
+
+    def zip_gets(self, status):
+        return self.standin.count('GET', zip_path(2027), status)
+
+    def test_range_honored(self):
+        # A whole 64 KiB comment keeps the central directory out of the tail, so it has to be fetched on its own
+        bundle = make_zip(2027, b'Readme', b'#' * 0xffff)
+        self.standin.zips[zip_path(2027)] = bundle
+        self.standin.ranges = 'honor'
+        self.run_program()
+        self.assertEqual(self.zip_gets(206), 3)
+        self.assertEqual(self.zip_gets(200), 0)
+        # What's saved isn't the bundle, so it isn't saved under the bundle's name
+        self.assertIsNone(self.saved(BUNDLE))
+        with zipfile.ZipFile(os.path.join(self.dest.name, REBUILT)) as rebuilt, \
+                zipfile.ZipFile(io.BytesIO(bundle)) as served:
+            self.assertEqual(rebuilt.namelist(), ['icd10cm_order_2027.txt'])
+            self.assertEqual(rebuilt.read('icd10cm_order_2027.txt'), served.read('icd10cm_order_2027.txt'))
+
+    def test_range_ignored(self):
+        self.run_program()
+        self.assertEqual(self.zip_gets(200), 1)
+        self.assertEqual(self.zip_gets(206), 0)
+        self.assertEqual(self.saved(BUNDLE), self.standin.zips[zip_path(2027)])
+        self.assertIsNone(self.saved(REBUILT))
+
+    def test_zip64(self):
+        self.standin.zips[zip_path(2027)] = make_zip64(make_zip(2027))
+        self.standin.ranges = 'honor'
+        self.run_program()
+        # The tail shows it's zip64, and the whole archive is downloaded instead
+        self.assertEqual(self.zip_gets(206), 1)
+        self.assertEqual(self.zip_gets(200), 1)
+        self.assertEqual(self.saved(BUNDLE), self.standin.zips[zip_path(2027)])
+        self.assertIsNone(self.saved(REBUILT))
+
+    def test_unknown_size(self):
+        self.standin.ranges = 'unknown'
+        self.run_program()
+        # Without the size there's no telling where the tail starts, so the whole archive is downloaded instead
+        self.assertEqual(self.zip_gets(206), 1)
+        self.assertEqual(self.zip_gets(200), 1)
+        self.assertEqual(self.saved(BUNDLE), self.standin.zips[zip_path(2027)])
+        self.assertIsNone(self.saved(REBUILT))
+
+
+if __name__ == '__main__':
+    unittest.main()
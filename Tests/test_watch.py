@@ -0,0 +1,116 @@
+"""
+Tests for --watch against the local stand-in: a check that's answered with 304s leaves the output alone, and a changed
+menu link, zip link or zip validator regenerates it.
+"""
+import os
+import os.path
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+from standin import PROGRAM, StandIn, make_zip, release_path, zip_path
+
+OUTPUT = 'Combined version - Filename_Base_2027.zip'
+
+
+def wait_for(check, timeout=20):
+    """
+    Poll check until it's true, or fail after timeout seconds.
+    """
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        if check():
+            return
+        time.sleep(0.1)
+    raise AssertionError('Timed out waiting for ' + check.__doc__)
+
+
+class WatchTest(unittest.TestCase):
+    """
+    Each test starts the program watching a fresh stand-in every second, waits for the first build, changes something,
+    and checks what the next checks do.
+    """
+
+    def setUp(self):
+        self.standin = StandIn().__enter__()
+        self.addCleanup(self.standin.__exit__)
+        self.dest = tempfile.TemporaryDirectory()
+        self.addCleanup(self.dest.cleanup)
+        self.log = open(os.path.join(self.dest.name, 'watch.log'), 'w')
+        self.addCleanup(self.log.close)
+        self.proc = subprocess.Popen([PROGRAM, '/u', self.standin.menu_url, '/p', self.dest.name, '--watch', '1'],
+                                     stdout=self.log, stderr=subprocess.STDOUT)
+        self.addCleanup(self.stop)
+        self.wait_for_builds(1)
+
+    def stop(self):
+        if self.proc.poll() is not None:
+            return
+        # Ctrl+C lets the check in progress finish; Windows has no SIGINT to send to another process
+        if sys.platform == 'win32':
+            self.proc.terminate()
+        else:
+            self.proc.send_signal(signal.SIGINT)
+        self.proc.wait(30)
+
+    def zip_gets(self):
+        return sum(self.standin.count('GET', path, 200) for path in self.standin.zips)
+
+    def checks_logged(self):
+        with open(self.log.name) as log:
+            return log.read().count('Checking again')
+
+    def wait_for_builds(self, builds):
+        def fetched():
+            """the zip to be fetched"""
+            return self.zip_gets() >= builds
+        wait_for(fetched)
+        # The zip is fetched before the output is written, so wait for that check to finish too
+        seen = self.checks_logged()
+        def finished():
+            """the check to finish"""
+            return self.checks_logged() > seen
+        wait_for(finished)
+        self.assertTrue(os.path.exists(os.path.join(self.dest.name, OUTPUT)))
+
+    def test_not_modified(self):
+        output = os.path.join(self.dest.name, OUTPUT)
+        before = os.stat(output).st_mtime_ns
+        checks = self.standin.count('GET', '/medicare/coding/icd10')
+        def checked():
+            """two more checks"""
+            return self.standin.count('GET', '/medicare/coding/icd10', 304) >= 2
+        wait_for(checked)
+        self.assertGreaterEqual(self.standin.count('GET', '/medicare/coding/icd10'), checks + 2)
+        self.assertGreaterEqual(self.standin.count('HEAD', zip_path(2027), 304), 2)
+        self.assertEqual(self.zip_gets(), 1)
+        self.assertEqual(os.stat(output).st_mtime_ns, before)
+        self.stop()
+        if sys.platform != 'win32':
+            self.assertEqual(self.proc.returncode, 0)
+
+    def test_menu_link_changed(self):
+        page = release_path(2027, '-update')
+        self.standin.pages[page] = zip_path(2027)
+        self.standin.menu = (page, '2027 ICD-10-CM')
+        self.wait_for_builds(2)
+        self.assertEqual(self.standin.count('GET', page, 200), 1)
+
+    def test_zip_link_changed(self):
+        moved = zip_path(2027, 'moved')
+        self.standin.zips[moved] = self.standin.zips[zip_path(2027)]
+        self.standin.pages[release_path(2027)] = moved
+        self.wait_for_builds(2)
+        self.assertEqual(self.standin.count('GET', moved, 200), 1)
+
+    def test_zip_validator_changed(self):
+        self.standin.zips[zip_path(2027)] = make_zip(2027, b'Replaced')
+        self.wait_for_builds(2)
+        self.assertEqual(self.standin.count('GET', zip_path(2027), 200), 2)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,151 @@
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+namespace {
+	// Index of the pool queue owned by the current thread, or npos if it isn't a pool worker.  Tasks submitted from a
+	// worker go on its own queue, which keeps related work on one core until someone else steals it
+	thread_local size_t worker_index = static_cast<size_t>(-1);
+	thread_local const ThreadPool *worker_pool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads) {
+	if (!num_threads) num_threads = 1;
+	queues.reserve(num_threads);
+	for (unsigned int i = 0; i < num_threads; i++) queues.push_back(make_unique<Queue>());
+	workers.reserve(num_threads);
+	for (unsigned int i = 0; i < num_threads; i++) workers.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(sleep_lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (thread &it : workers) it.join();
+}
+
+ThreadPool &ThreadPool::instance() {
+	// hardware_concurrency can report 0 when it doesn't know; the constructor bumps that to 1
+	static ThreadPool pool(thread::hardware_concurrency());
+	return pool;
+}
+
+void ThreadPool::submit(Group &group, function<void()> task) {
+	group.pending.fetch_add(1, memory_order_relaxed);
+	size_t index = (worker_pool == this) ? worker_index : next_queue.fetch_add(1, memory_order_relaxed) % queues.size();
+	{
+		lock_guard<mutex> lock(queues[index]->lock);
+		queues[index]->tasks.push_back(Task {move(task), &group});
+	}
+	queued.fetch_add(1, memory_order_release);
+	// Take the sleep lock so a worker can't check queued and then go to sleep between the increment and the notify
+	{
+		lock_guard<mutex> lock(sleep_lock);
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::wait(Group &group) {
+	size_t home = (worker_pool == this) ? worker_index : 0;
+	while (group.pending.load(memory_order_acquire)) {
+		// Help out rather than block.  Only sleep once there's nothing left to pick up, at which point the group's
+		// remaining tasks are running on other threads
+		if (try_run(home)) continue;
+		unique_lock<mutex> lock(sleep_lock);
+		wake.wait(lock, [&] { return !group.pending.load(memory_order_acquire) || queued.load(memory_order_acquire); });
+	}
+	// The last task finishes under the group's lock; taking it here means that task is completely done with the group
+	// before the caller is free to destroy it
+	exception_ptr error;
+	{
+		lock_guard<mutex> lock(group.lock);
+		swap(error, group.error);
+	}
+	if (error) rethrow_exception(error);
+}
+
+bool ThreadPool::try_run(size_t home) {
+	Task task;
+	bool found = false;
+	// Own queue first, newest task first (it's the one most likely to still be in cache)
+	{
+		lock_guard<mutex> lock(queues[home]->lock);
+		if (!queues[home]->tasks.empty()) {
+			task = move(queues[home]->tasks.back());
+			queues[home]->tasks.pop_back();
+			found = true;
+		}
+	}
+	// Then steal the oldest task from everyone else
+	for (size_t i = 1; !found && i < queues.size(); i++) {
+		Queue &victim = *queues[(home + i) % queues.size()];
+		lock_guard<mutex> lock(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = move(victim.tasks.front());
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+	if (!found) return false;
+	queued.fetch_sub(1, memory_order_acq_rel);
+	run(task);
+	return true;
+}
+
+void ThreadPool::run(Task &task) {
+	Group &group = *task.group;
+	try {
+		task.func();
+	} catch (...) {
+		lock_guard<mutex> lock(group.lock);
+		if (!group.error) group.error = current_exception();
+	}
+	// Destroy the task (and whatever it captured) before reporting it done, so its memory is back before wait returns
+	task.func = nullptr;
+	finish(group);
+}
+
+void ThreadPool::finish(Group &group) {
+	bool last = false;
+	{
+		// Decrement under the group's lock; see wait.  The group may be gone as soon as this is released
+		lock_guard<mutex> lock(group.lock);
+		last = group.pending.fetch_sub(1, memory_order_acq_rel) == 1;
+	}
+	if (!last) return;
+	// Through the sleep lock, like submit, so a waiter can't check pending and then go to sleep past the notify
+	{
+		lock_guard<mutex> lock(sleep_lock);
+	}
+	wake.notify_all();
+}
+
+ThreadPool::Node::Node(ThreadPool &pool, Group &group, size_t deps, function<void()> task) :
+	owner(pool), grp(group), remaining(deps), func(move(task)) {
+	grp.pending.fetch_add(1, memory_order_relaxed);
+	if (!deps) fire();
+}
+
+void ThreadPool::Node::arrive() {
+	if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) fire();
+}
+
+void ThreadPool::Node::fire() {
+	// Submit the real task before dropping the node's own count, so the group can't look finished in between.  Nothing
+	// may touch the node after finish, since the waiter is then free to return and destroy it
+	owner.submit(grp, move(func));
+	owner.finish(grp);
+}
+
+void ThreadPool::worker_loop(size_t index) {
+	worker_index = index;
+	worker_pool = this;
+	while (true) {
+		if (try_run(index)) continue;
+		unique_lock<mutex> lock(sleep_lock);
+		wake.wait(lock, [&] { return stopping || queued.load(memory_order_acquire); });
+		if (stopping && !queued.load(memory_order_acquire)) return;
+	}
+}
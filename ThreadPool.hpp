@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide work-stealing pool.  Each worker has its own deque: it pops its own work from the back and steals from the
+// front of everyone else's when it runs dry.  Tasks are tracked by a Group, and wait() runs queued tasks on the waiting
+// thread until the group is done, so waiting from inside a task can't deadlock the pool.  Waiters sleep on the same
+// condition as idle workers, so a task submitted while every worker is waiting still wakes one of them to run it.  Node
+// builds dependency graphs on top of that.
+class ThreadPool {
+public: // API methods and constructors should be public
+	class Group {
+	public: // API methods and constructors should be public
+		Group() = default;
+		Group(const Group &) = delete;
+		Group &operator=(const Group &) = delete;
+	private: // Only the pool touches these
+		friend class ThreadPool;
+		std::atomic<size_t> pending {0};
+		std::mutex lock;
+		std::exception_ptr error; // First exception thrown by one of the group's tasks; rethrown by wait
+	};
+	// A task with dependencies.  It's submitted to its group once arrive() has been called deps times, so a pipeline can be
+	// wired up as a graph and each step starts the moment its own inputs are ready.  The group counts the node from the
+	// moment it's created, so waiting on the group also waits for nodes that haven't fired yet.  A node must outlive the
+	// tasks that arrive on it, which is guaranteed when it's declared before the wait on its group
+	class Node {
+	public: // API methods and constructors should be public
+		Node(ThreadPool &pool, Group &group, size_t deps, std::function<void()> task);
+		Node(const Node &) = delete;
+		Node &operator=(const Node &) = delete;
+		void arrive();
+	private: // Nothing else needs to see these
+		ThreadPool &owner;
+		Group &grp;
+		std::atomic<size_t> remaining;
+		std::function<void()> func;
+		void fire();
+	};
+	explicit ThreadPool(unsigned int num_threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+	static ThreadPool &instance();
+	void submit(Group &group, std::function<void()> task);
+	void wait(Group &group);
+	unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+protected: // Children are going to need access to these, but the API doesn't need to reveal them
+	struct Task {
+		std::function<void()> func;
+		Group *group = nullptr;
+	};
+	struct Queue {
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued {0}; // Tasks sitting in any queue; lets idle workers sleep instead of spinning
+	std::atomic<size_t> next_queue {0}; // Round robin for submits that don't come from a worker
+	std::atomic<bool> stopping {false};
+	std::mutex sleep_lock;
+	std::condition_variable wake; // Idle workers and waiters alike sleep on this, for new tasks or a finished group
+	bool try_run(size_t home);
+	void run(Task &task);
+	void finish(Group &group);
+	void worker_loop(size_t index);
+};